@@ -1,3 +1,5 @@
+#include <sstream>
+
 #include <boost/filesystem/fstream.hpp>
 
 #include <elle/serialize/PairSerializer.hxx>
@@ -26,7 +28,12 @@ namespace surface
       _count(),
       _full_size(),
       _files(),
-      _key_code()
+      _key_code(),
+      _index(),
+      _index_position(0),
+      _segment(0),
+      _segment_output(),
+      _index_output()
     {
       try
       {
@@ -44,6 +51,7 @@ namespace surface
       {
         throw DataExhausted();
       }
+      this->_index_load();
     }
 
     FilesystemTransferBufferer::FilesystemTransferBufferer(
@@ -58,7 +66,12 @@ namespace surface
       _count(count),
       _full_size(full_size),
       _files(files),
-      _key_code(key)
+      _key_code(key),
+      _index(),
+      _index_position(0),
+      _segment(0),
+      _segment_output(),
+      _index_output()
     {
       create_directories(this->_root);
       {
@@ -77,6 +90,7 @@ namespace surface
         elle::serialize::to_file((this->_root / "key").string())
           << key;
       }
+      this->_index_load();
     }
 
     /*------.
@@ -131,46 +145,156 @@ namespace surface
                                     FileSize size,
                                     elle::ConstWeakBuffer const& b)
     {
-      auto filename = this->_filename(file, offset);
-      boost::filesystem::ofstream output(filename);
-      output.write(reinterpret_cast<const char*>(b.contents()), b.size());
-      reactor::sleep(20_ms);
+      ELLE_DEBUG_SCOPE("%s: put: %s (offset: %s, size: %s)",
+                       *this, file, offset, size);
+      auto open = [this]
+        {
+          this->_segment_output.reset(
+            new boost::filesystem::ofstream(
+              this->_segment_path(this->_segment),
+              std::ios_base::app | std::ios_base::binary));
+          // Append after whatever the segment holds, indexed or not.
+          this->_segment_output->seekp(0, std::ios_base::end);
+        };
+      if (!this->_segment_output)
+        open();
+      std::streamoff position = this->_segment_output->tellp();
+      if (position > 0 && position + b.size() > segment_size_max)
+      {
+        ++this->_segment;
+        open();
+        position = this->_segment_output->tellp();
+      }
+      if (!this->_index_output)
+        this->_index_output.reset(
+          new boost::filesystem::ofstream(this->_root / "index",
+                                          std::ios_base::app));
+      auto& output = *this->_segment_output;
+      if (position >= 0)
+      {
+        output.write(reinterpret_cast<const char*>(b.contents()), b.size());
+        output.flush();
+      }
+      if (position < 0 || !output)
+      {
+        // Reopen on the next put, a failed stream stays failed.
+        this->_segment_output.reset();
+        throw elle::Error(
+          elle::sprintf("%s: unable to write segment %s",
+                        *this, this->_segment));
+      }
+      Block block{this->_segment, FileSize(position), b.size()};
+      // Only index the block once its data is on disk.
+      *this->_index_output << file << " " << offset << " " << block.segment
+                           << " " << block.position << " " << block.size
+                           << std::endl;
+      this->_index[std::make_pair(file, offset)] = block;
     }
 
     elle::Buffer
     FilesystemTransferBufferer::get(FileID file,
                                     FileOffset offset)
     {
-      auto filename = this->_filename(file, offset);
-      boost::filesystem::ifstream input(filename);
-      input.seekg(0, std::ios::end);
-      std::ios::pos_type size = input.tellg();
-      if (size == std::ios::pos_type(-1))
+      ELLE_DEBUG_SCOPE("%s: get: %s (offset: %s)", *this, file, offset);
+      auto it = this->_index.find(std::make_pair(file, offset));
+      if (it == this->_index.end())
       {
-        ELLE_TRACE("Data exhausted on %s/%s at %s", file, offset, filename);
+        // The block may have been put by another process since.
+        this->_index_refresh();
+        it = this->_index.find(std::make_pair(file, offset));
+      }
+      if (it == this->_index.end())
+      {
+        ELLE_TRACE("Data exhausted on %s/%s", file, offset);
+        throw DataExhausted();
+      }
+      auto const& block = it->second;
+      boost::filesystem::ifstream input(this->_segment_path(block.segment),
+                                        std::ios_base::binary);
+      input.seekg(block.position);
+      elle::Buffer res(block.size);
+      input.read(reinterpret_cast<char*>(res.mutable_contents()), block.size);
+      if (input.gcount() != std::streamsize(block.size))
+      {
+        ELLE_WARN("%s: block %s/%s truncated in segment %s",
+                  *this, file, offset, block.segment);
         throw DataExhausted();
       }
-      elle::Buffer res(size);
-      input.seekg(0, std::ios::beg);
-      input.read(reinterpret_cast<char*>(res.mutable_contents()), size);
-      reactor::sleep(20_ms);
       return res;
     }
 
+    TransferBufferer::List
+    FilesystemTransferBufferer::list()
+    {
+      List res;
+      res.reserve(this->_index.size());
+      for (auto const& block: this->_index)
+        res.push_back(
+          std::make_pair(block.first.first,
+                         std::make_pair(block.first.second,
+                                        block.second.size)));
+      return res;
+    }
+
+    /*--------.
+    | Storage |
+    `--------*/
+
+    FilesystemTransferBufferer::FileSize const
+    FilesystemTransferBufferer::segment_size_max = 64 * 1024 * 1024;
+
     boost::filesystem::path
-    FilesystemTransferBufferer::_filename(FileID file,
-                                          FileOffset offset)
+    FilesystemTransferBufferer::_segment_path(int segment) const
     {
-      auto dir = this->_root / std::to_string(file);
-      create_directory(dir);
-      return dir / boost::filesystem::path(
-        std::to_string(offset));
+      return this->_root / elle::sprintf("segment.%s", segment);
     }
 
-    TransferBufferer::List
-    FilesystemTransferBufferer::list()
+    void
+    FilesystemTransferBufferer::_index_load()
     {
-      return std::vector<std::pair<FileID, std::pair<FileSize, FileSize>>>();
+      this->_index_refresh();
+      // Resume appending to the last segment, including one started before
+      // a crash but never indexed.
+      while (boost::filesystem::exists(this->_segment_path(this->_segment + 1)))
+        ++this->_segment;
+      ELLE_TRACE("%s: loaded %s blocks", *this, this->_index.size());
+    }
+
+    void
+    FilesystemTransferBufferer::_index_refresh()
+    {
+      boost::filesystem::ifstream input(this->_root / "index");
+      input.seekg(this->_index_position);
+      std::string line;
+      while (std::getline(input, line))
+      {
+        // Incomplete last record, being written.
+        if (input.eof())
+          break;
+        this->_index_position += line.size() + 1;
+        std::stringstream record(line);
+        FileID file;
+        FileOffset offset;
+        Block block;
+        if (!(record >> file >> offset >> block.segment
+                     >> block.position >> block.size))
+        {
+          ELLE_WARN("%s: ignore invalid index record: %s", *this, line);
+          continue;
+        }
+        // A record may outlive its data if we died mid-write.
+        boost::system::error_code erc;
+        auto size = boost::filesystem::file_size(
+          this->_segment_path(block.segment), erc);
+        if (erc || size < block.position + block.size)
+        {
+          ELLE_WARN("%s: drop block %s/%s missing from segment %s",
+                    *this, file, offset, block.segment);
+          continue;
+        }
+        this->_index[std::make_pair(file, offset)] = block;
+        this->_segment = std::max(this->_segment, block.segment);
+      }
     }
 
     /*----------.
@@ -186,7 +310,14 @@ namespace surface
     void
     FilesystemTransferBufferer::cleanup()
     {
-
+      ELLE_TRACE_SCOPE("%s: cleanup", *this);
+      this->_segment_output.reset();
+      this->_index_output.reset();
+      this->_index.clear();
+      boost::system::error_code erc;
+      boost::filesystem::remove_all(this->_root, erc);
+      if (erc)
+        ELLE_WARN("%s: unable to remove %s: %s", *this, this->_root, erc);
     }
   }
 }
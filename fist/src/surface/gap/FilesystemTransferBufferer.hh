@@ -1,6 +1,9 @@
 #ifndef SURFACE_GAP_FILESYSTEM_TRANSFER_BUFFERER_HH
 # define SURFACE_GAP_FILESYSTEM_TRANSFER_BUFFERER_HH
 
+# include <map>
+
+# include <boost/filesystem/fstream.hpp>
 # include <boost/filesystem/path.hpp>
 
 # include <elle/attribute.hh>
@@ -91,10 +94,38 @@ namespace surface
       virtual
       void
       cleanup() override;
+
+    /*--------.
+    | Storage |
+    `--------*/
+    public:
+      /// Size above which a new segment file is started.
+      static FileSize const segment_size_max;
     private:
+      /// Location of a buffered block in the segment files.
+      struct Block
+      {
+        int segment;
+        FileSize position;
+        FileSize size;
+      };
+      typedef std::map<std::pair<FileID, FileOffset>, Block> Index;
+      /// Load the block index and position the current segment.
+      void
+      _index_load();
+      /// Read index records appended since the last refresh, dropping those
+      /// whose data is missing.
+      void
+      _index_refresh();
       boost::filesystem::path
-      _filename(FileID file,
-                FileOffset offset);
+      _segment_path(int segment) const;
+      ELLE_ATTRIBUTE(Index, index);
+      ELLE_ATTRIBUTE(std::streamoff, index_position);
+      ELLE_ATTRIBUTE(int, segment);
+      ELLE_ATTRIBUTE(std::unique_ptr<boost::filesystem::ofstream>,
+                     segment_output);
+      ELLE_ATTRIBUTE(std::unique_ptr<boost::filesystem::ofstream>,
+                     index_output);
 
     /*----------.
     | Printable |
@@ -1,13 +1,16 @@
 #include <surface/gap/GhostReceiveMachine.hh>
 
 #include <boost/filesystem/fstream.hpp>
+#include <boost/lexical_cast.hpp>
 
 #include <elle/AtomicFile.hh>
+#include <elle/os/environ.hh>
 #include <elle/serialization/json/SerializerIn.hh>
 #include <elle/serialization/json/SerializerOut.hh>
 #include <elle/system/system.hh>
 #include <elle/archive/archive.hh>
 
+#include <reactor/Scope.hh>
 #include <reactor/exception.hh>
 #include <reactor/http/Request.hh>
 #include <reactor/http/url.hh>
@@ -37,6 +40,8 @@ namespace surface
           std::bind(&GhostReceiveMachine::_wait_for_cloud_upload, this)))
       , _snapshot_path(this->transaction().snapshots_directory()
                         / "ghostreceive.snapshot")
+      , _download_total(0)
+      , _downloaded(0)
       , _completed(false)
     {
       this->_machine.transition_add(this->_wait_for_cloud_upload_state,
@@ -122,6 +127,8 @@ namespace surface
     float
     GhostReceiveMachine::progress() const
     {
+      if (this->_download_total)
+        return float(this->_downloaded) / float(this->_download_total);
       if (!_request)
         return 0;
       reactor::http::Request::Progress p = _request->progress();
@@ -282,43 +289,9 @@ namespace surface
                 infinit::metrics::TransferMethodCloud,
                 0);
             }
-            boost::system::error_code erc;
-            _previous_progress = boost::filesystem::file_size(_path, erc);
-            if (erc)
-              _previous_progress = 0;
-            ELLE_TRACE("%s: resuming at %s", *this, _previous_progress);
             boost::filesystem::create_directories(_path.parent_path());
-            elle::system::FileHandle file(_path, elle::system::FileHandle::APPEND);
-            using namespace reactor::http;
-            Request::Configuration config
-              = Request::Configuration(reactor::DurationOpt(), 60_sec);
-            config.header_add("Range", elle::sprintf("bytes=%s-", _previous_progress));
-            _request = elle::make_unique<Request>(url, Method::GET, config);
-            _request->finalize();
-            // Waiting for the status here will wait for full download.
-            static const int buffer_size = 16000;
-            elle::Buffer buffer(buffer_size);
-            while (true)
-            {
-              ELLE_DUMP("%s: read", *this);
-              _request->read((char*)buffer.contents(), buffer_size);
-              int bytes_read = _request->gcount();
-              ELLE_DUMP("%s: read %s,  progress %s", *this, bytes_read, progress());
-              StatusCode s = _request->status();
-              if (s != static_cast<StatusCode>(0) && s != StatusCode::OK
-                && s != StatusCode::Partial_Content)
-                 throw std::runtime_error( // Consider this as fatal.
-                   elle::sprintf("HTTP error %s : %s",
-                                 s, buffer.string()));
-              if (!bytes_read)
-                break;
-              buffer.size(bytes_read);
-              // Because writing on the disk is not asynchronous, it might block
-              // this thread (especially on Windows) if the filesystem is slow.
-              reactor::yield();
-              file.write(buffer);
-              total_bytes_transfered += bytes_read;
-            }
+            if (!this->_download_ranges(url, total_bytes_transfered))
+              this->_download_sequential(url, total_bytes_transfered);
             exit_reason = infinit::metrics::TransferExitReasonFinished;
             break;
           }
@@ -361,6 +334,242 @@ namespace surface
       this->_completed = true;
     }
 
+    void
+    GhostReceiveMachine::_download_sequential(std::string const& url,
+                                              uint64_t& transferred)
+    {
+      boost::system::error_code erc;
+      _previous_progress = boost::filesystem::file_size(_path, erc);
+      if (erc)
+        _previous_progress = 0;
+      ELLE_TRACE("%s: resuming at %s", *this, _previous_progress);
+      elle::system::FileHandle file(_path, elle::system::FileHandle::APPEND);
+      using namespace reactor::http;
+      Request::Configuration config
+        = Request::Configuration(reactor::DurationOpt(), 60_sec);
+      config.header_add("Range", elle::sprintf("bytes=%s-", _previous_progress));
+      _request = elle::make_unique<Request>(url, Method::GET, config);
+      _request->finalize();
+      // Waiting for the status here will wait for full download.
+      static const int buffer_size = 16000;
+      elle::Buffer buffer(buffer_size);
+      while (true)
+      {
+        ELLE_DUMP("%s: read", *this);
+        _request->read((char*)buffer.contents(), buffer_size);
+        int bytes_read = _request->gcount();
+        ELLE_DUMP("%s: read %s,  progress %s", *this, bytes_read, progress());
+        StatusCode s = _request->status();
+        if (s != static_cast<StatusCode>(0) && s != StatusCode::OK
+          && s != StatusCode::Partial_Content)
+           throw std::runtime_error( // Consider this as fatal.
+             elle::sprintf("HTTP error %s : %s",
+                           s, buffer.string()));
+        if (!bytes_read)
+          break;
+        buffer.size(bytes_read);
+        // Because writing on the disk is not asynchronous, it might block
+        // this thread (especially on Windows) if the filesystem is slow.
+        reactor::yield();
+        file.write(buffer);
+        transferred += bytes_read;
+      }
+    }
+
+    bool
+    GhostReceiveMachine::_download_ranges(std::string const& url,
+                                          uint64_t& transferred)
+    {
+      using namespace reactor::http;
+      auto ranges_path =
+        this->transaction().snapshots_directory() / "ghostreceive.ranges";
+      // Pending ranges: [starts[i], ends[i]) remains to be downloaded.
+      int64_t total = 0;
+      std::vector<int64_t> starts;
+      std::vector<int64_t> ends;
+      auto save = [&]
+        {
+          elle::AtomicFile file(ranges_path);
+          file.write() << [&] (elle::AtomicFile::Write& write)
+          {
+            elle::serialization::json::SerializerOut output(
+              write.stream(), false);
+            output.serialize("total", total);
+            output.serialize("starts", starts);
+            output.serialize("ends", ends);
+          };
+        };
+      if (boost::filesystem::exists(ranges_path))
+      {
+        elle::AtomicFile file(ranges_path);
+        file.read() << [&] (elle::AtomicFile::Read& read)
+        {
+          elle::serialization::json::SerializerIn input(read.stream(), false);
+          input.serialize("total", total);
+          input.serialize("starts", starts);
+          input.serialize("ends", ends);
+        };
+        ELLE_TRACE("%s: resume ranged download of %s bytes", *this, total);
+      }
+      else
+      {
+        int parallelism =
+          this->state().configuration().s3.multipart_upload.parallelism;
+        std::string env_parallelism =
+          elle::os::getenv("INFINIT_NUM_GHOST_DOWNLOAD_THREAD", "");
+        if (!env_parallelism.empty())
+          parallelism = boost::lexical_cast<int>(env_parallelism);
+        if (parallelism < 2)
+          return false;
+        // Probe for range support and the total size.
+        {
+          Request::Configuration config(reactor::DurationOpt(), 60_sec);
+          config.header_add("Range", "bytes=0-0");
+          Request probe(url, Method::GET, config);
+          probe.finalize();
+          char byte;
+          probe.read(&byte, 1);
+          if (probe.status() != StatusCode::Partial_Content)
+          {
+            ELLE_TRACE("%s: ranges not supported (%s), download sequentially",
+                       *this, probe.status());
+            return false;
+          }
+          auto headers = probe.headers();
+          auto it = headers.find("Content-Range");
+          if (it == headers.end())
+            return false;
+          // expect bytes 0-0/total
+          auto slash = it->second.find_last_of('/');
+          if (slash == std::string::npos)
+            return false;
+          try
+          {
+            total = std::stoll(it->second.substr(slash + 1));
+          }
+          catch (std::exception const&)
+          {
+            ELLE_TRACE("%s: unknown total size in %s, download sequentially",
+                       *this, it->second);
+            return false;
+          }
+        }
+        // Keep what a previous sequential download already fetched.
+        boost::system::error_code erc;
+        int64_t done = boost::filesystem::file_size(this->_path, erc);
+        if (erc || done > total)
+          done = 0;
+        static int64_t const min_range_size = 4 * 1024 * 1024;
+        int count =
+          std::min<int64_t>(parallelism, (total - done) / min_range_size);
+        if (count < 2)
+          return false;
+        int64_t range_size = (total - done) / count;
+        for (int i = 0; i < count; ++i)
+        {
+          starts.push_back(done + i * range_size);
+          ends.push_back(i == count - 1 ? total : done + (i + 1) * range_size);
+        }
+        ELLE_TRACE("%s: download %s bytes in %s ranges from %s",
+                   *this, total, count, done);
+        // Record the ranges before growing the file: past this point its
+        // size no longer tells how much was downloaded.
+        save();
+        // Preallocate the file so ranges can be written at their offset.
+        boost::filesystem::ofstream(
+          this->_path, std::ios_base::app | std::ios_base::binary);
+        boost::filesystem::resize_file(this->_path, total);
+      }
+      this->_download_total = total;
+      this->_downloaded = total;
+      for (unsigned i = 0; i < starts.size(); ++i)
+        this->_downloaded -= ends[i] - starts[i];
+      boost::filesystem::fstream output(
+        this->_path,
+        std::ios_base::in | std::ios_base::out | std::ios_base::binary);
+      if (!output)
+        throw boost::filesystem::filesystem_error(
+          "unable to open download target", this->_path,
+          boost::system::errc::make_error_code(
+            boost::system::errc::io_error));
+      // Persist progress every so often so an interruption only loses the
+      // bytes downloaded since.
+      static int64_t const save_interval = 4 * 1024 * 1024;
+      int64_t unsaved = 0;
+      auto checkpoint = [&]
+        {
+          output.flush();
+          save();
+          unsaved = 0;
+        };
+      try
+      {
+        elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+        {
+          for (unsigned i = 0; i < starts.size(); ++i)
+          {
+            if (starts[i] >= ends[i])
+              continue;
+            scope.run_background(
+              elle::sprintf("%s: range %s", *this, i),
+              [&, i]
+              {
+                Request::Configuration config(reactor::DurationOpt(), 60_sec);
+                config.header_add(
+                  "Range", elle::sprintf("bytes=%s-%s", starts[i], ends[i] - 1));
+                Request request(url, Method::GET, config);
+                request.finalize();
+                static const int buffer_size = 65536;
+                elle::Buffer buffer(buffer_size);
+                while (starts[i] < ends[i])
+                {
+                  request.read(
+                    (char*)buffer.contents(),
+                    std::min<int64_t>(buffer_size, ends[i] - starts[i]));
+                  int bytes_read = request.gcount();
+                  StatusCode s = request.status();
+                  if (s != static_cast<StatusCode>(0) &&
+                      s != StatusCode::Partial_Content)
+                    throw std::runtime_error( // Consider this as fatal.
+                      elle::sprintf("HTTP error %s on range %s-%s",
+                                    s, starts[i], ends[i]));
+                  if (!bytes_read)
+                    throw reactor::network::Exception(
+                      elle::sprintf("range %s-%s ended prematurely",
+                                    starts[i], ends[i]));
+                  // Because writing on the disk is not asynchronous, it might
+                  // block this thread if the filesystem is slow.
+                  reactor::yield();
+                  output.seekp(starts[i]);
+                  output.write((char const*)buffer.contents(), bytes_read);
+                  if (!output)
+                    throw boost::filesystem::filesystem_error(
+                      "unable to write download target", this->_path,
+                      boost::system::errc::make_error_code(
+                        boost::system::errc::io_error));
+                  starts[i] += bytes_read;
+                  this->_downloaded += bytes_read;
+                  transferred += bytes_read;
+                  unsaved += bytes_read;
+                  if (unsaved >= save_interval)
+                    checkpoint();
+                }
+              });
+          }
+          reactor::wait(scope);
+        };
+      }
+      catch (...)
+      {
+        if (output)
+          checkpoint();
+        throw;
+      }
+      output.close();
+      boost::filesystem::remove(ranges_path);
+      return true;
+    }
+
     bool
     GhostReceiveMachine::completed() const
     {
@@ -61,6 +61,14 @@ namespace surface
     private:
       void
       _run_from_snapshot();
+      /// Download url to path in one request, resuming after the bytes
+      /// already present.
+      void
+      _download_sequential(std::string const& url, uint64_t& transferred);
+      /// Download url to path with parallel ranged requests. Return false
+      /// without side effects if the server or the size does not warrant it.
+      bool
+      _download_ranges(std::string const& url, uint64_t& transferred);
 
       reactor::Barrier _cloud_uploaded;
       reactor::fsm::State& _wait_for_cloud_upload_state;
@@ -68,6 +76,8 @@ namespace surface
       ELLE_ATTRIBUTE_R(std::unique_ptr<reactor::http::Request>, request);
       ELLE_ATTRIBUTE_R(int64_t, previous_progress);
       ELLE_ATTRIBUTE_R(boost::filesystem::path, path);
+      ELLE_ATTRIBUTE_R(int64_t, download_total);
+      ELLE_ATTRIBUTE_R(int64_t, downloaded);
       ELLE_ATTRIBUTE(bool, completed);
     };
   }
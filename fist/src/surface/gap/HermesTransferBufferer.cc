@@ -0,0 +1,481 @@
+#include <boost/lexical_cast.hpp>
+
+#include <elle/Exception.hh>
+#include <elle/assert.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/os/environ.hh>
+#include <elle/serialize/PairSerializer.hxx>
+#include <elle/serialize/VectorSerializer.hxx>
+#include <elle/serialize/extract.hh>
+#include <elle/serialize/insert.hh>
+
+#include <reactor/network/exception.hh>
+#include <reactor/network/tcp-socket.hh>
+#include <reactor/scheduler.hh>
+
+#include <protocol/ChanneledStream.hh>
+#include <protocol/Serializer.hh>
+
+#include <surface/gap/HermesTransferBufferer.hh>
+
+ELLE_LOG_COMPONENT("surface.gap.HermesTransferBufferer");
+
+namespace surface
+{
+  namespace gap
+  {
+    /*-------.
+    | Layout |
+    `-------*/
+
+    // The transfer meta-data are stored in the first Hermes file, and each
+    // sender session in a data file and an index file of fixed size records:
+    // file, offset, position in the data file and size of each block, as
+    // big endian 64 bits integers. Data files start with a byte claiming the
+    // session before any block is stored.
+
+    typedef std::pair<std::pair<TransferBufferer::FileCount,
+                                TransferBufferer::FileSize>,
+                      std::pair<HermesTransferBufferer::Files,
+                                infinit::cryptography::Code>> MetaData;
+
+    static TransferBufferer::FileID const meta_data_file = 0;
+    static TransferBufferer::FileSize const record_size = 32;
+    /// Bytes requested by a single fetch of meta-data or index records.
+    static TransferBufferer::FileSize const fetch_size = 16 * 1024 * 1024;
+
+    static
+    TransferBufferer::FileID
+    data_file(int session)
+    {
+      return 1 + 2 * session;
+    }
+
+    static
+    TransferBufferer::FileID
+    index_file(int session)
+    {
+      return 2 + 2 * session;
+    }
+
+    static
+    void
+    encode(unsigned char* data, uint64_t value)
+    {
+      for (int i = 7; i >= 0; --i, value >>= 8)
+        data[i] = value & 0xff;
+    }
+
+    static
+    uint64_t
+    decode(unsigned char const* data)
+    {
+      uint64_t value = 0;
+      for (int i = 0; i < 8; ++i)
+        value = (value << 8) | data[i];
+      return value;
+    }
+
+    /*-------------.
+    | Construction |
+    `-------------*/
+
+    HermesTransferBufferer::RPC::RPC(
+      infinit::protocol::ChanneledStream& channels):
+      infinit::protocol::RPC<elle::serialize::InputBinaryArchive,
+                             elle::serialize::OutputBinaryArchive>(channels),
+      ident("ident", *this),
+      store("store", *this),
+      fetch("fetch", *this),
+      remove("remove", *this)
+    {}
+
+    // Recipient.
+    HermesTransferBufferer::HermesTransferBufferer(
+      infinit::oracles::PeerTransaction& transaction,
+      std::string const& host,
+      int port,
+      int connections):
+      Super(transaction),
+      _count(),
+      _full_size(),
+      _files(),
+      _key_code(),
+      _host(host),
+      _port(port),
+      _connections_max(connections),
+      _connections(0),
+      _idle(),
+      _released(),
+      _index(),
+      _index_read(),
+      _refresh_mutex(),
+      _session(-1),
+      _data_position(0),
+      _index_position(0)
+    {
+      elle::Buffer buffer = this->_fetch(meta_data_file, 0, fetch_size);
+      if (buffer.size() == 0)
+      {
+        ELLE_LOG("%s: no meta-data on Hermes", *this);
+        throw DataExhausted();
+      }
+      MetaData meta_data;
+      elle::serialize::from_string(buffer.string()) >> meta_data;
+      this->_count = meta_data.first.first;
+      this->_full_size = meta_data.first.second;
+      this->_files = meta_data.second.first;
+      this->_key_code = meta_data.second.second;
+      this->_index_refresh();
+    }
+
+    // Sender.
+    HermesTransferBufferer::HermesTransferBufferer(
+      infinit::oracles::PeerTransaction& transaction,
+      std::string const& host,
+      int port,
+      FileCount count,
+      FileSize total_size,
+      Files const& files,
+      infinit::cryptography::Code const& key,
+      int connections):
+      Super(transaction),
+      _count(count),
+      _full_size(total_size),
+      _files(files),
+      _key_code(key),
+      _host(host),
+      _port(port),
+      _connections_max(connections),
+      _connections(0),
+      _idle(),
+      _released(),
+      _index(),
+      _index_read(),
+      _refresh_mutex(),
+      _session(-1),
+      _data_position(0),
+      _index_position(0)
+    {
+      // Meta-data never change: storing them again is harmless.
+      std::string meta_data_string;
+      elle::serialize::to_string(meta_data_string) << MetaData(
+        std::make_pair(count, total_size), std::make_pair(files, key));
+      elle::Buffer meta_data(meta_data_string.data(), meta_data_string.size());
+      this->_call([&] (RPC& rpc)
+                  {
+                    rpc.store(meta_data_file, 0, meta_data);
+                  });
+      // Previous sessions may have left blocks behind: keep them and use new
+      // files, whose bytes can't have been stored already.
+      this->_index_refresh();
+      this->_session = this->_index_read.size();
+      ELLE_TRACE("%s: start session %s", *this, this->_session);
+      elle::Buffer claim(1);
+      claim.mutable_contents()[0] = 0;
+      this->_call([&] (RPC& rpc)
+                  {
+                    rpc.store(data_file(this->_session), 0, claim);
+                  });
+      this->_data_position = claim.size();
+    }
+
+    HermesTransferBufferer::~HermesTransferBufferer()
+    {}
+
+    boost::optional<HermesTransferBufferer::Server>
+    HermesTransferBufferer::server()
+    {
+      std::string server = elle::os::getenv("INFINIT_CLOUD_HERMES", "");
+      if (server.empty())
+        return boost::none;
+      auto colon = server.rfind(':');
+      if (colon == std::string::npos)
+        throw elle::Exception(
+          elle::sprintf("invalid Hermes server, expected host:port: %s",
+                        server));
+      return Server(server.substr(0, colon),
+                    boost::lexical_cast<int>(server.substr(colon + 1)));
+    }
+
+    /*------.
+    | Frete |
+    `------*/
+
+    std::vector<std::pair<std::string, HermesTransferBufferer::FileSize>>
+    HermesTransferBufferer::files_info() const
+    {
+      return this->_files;
+    }
+
+    infinit::cryptography::Code
+    HermesTransferBufferer::read(FileID f, FileOffset start, FileSize size)
+    {
+      elle::unreachable();
+    }
+
+    infinit::cryptography::Code
+    HermesTransferBufferer::encrypted_read(FileID f,
+                                           FileOffset start,
+                                           FileSize)
+    {
+      return infinit::cryptography::Code(this->get(f, start));
+    }
+
+    /*----------.
+    | Buffering |
+    `----------*/
+
+    void
+    HermesTransferBufferer::put(FileID file,
+                                FileOffset offset,
+                                FileSize size,
+                                elle::ConstWeakBuffer const& b)
+    {
+      ELLE_DEBUG_SCOPE("%s: put: %s (offset: %s, size: %s)",
+                       *this, file, offset, size);
+      ELLE_ASSERT_GTE(this->_session, 0);
+      // Reserve room before yielding, so concurrent puts are in flight at
+      // once.
+      Block block{this->_session, this->_data_position, b.size()};
+      FileOffset record_position = this->_index_position;
+      this->_data_position += b.size();
+      this->_index_position += record_size;
+      elle::Buffer data(b.contents(), b.size());
+      this->_call([&] (RPC& rpc)
+                  {
+                    rpc.store(data_file(block.session), block.position, data);
+                  });
+      // Only index the block once its data is stored: recipients read the
+      // records up to the first missing one.
+      elle::Buffer record(record_size);
+      encode(record.mutable_contents(), file);
+      encode(record.mutable_contents() + 8, offset);
+      encode(record.mutable_contents() + 16, block.position);
+      encode(record.mutable_contents() + 24, block.size);
+      this->_call([&] (RPC& rpc)
+                  {
+                    rpc.store(index_file(block.session), record_position,
+                              record);
+                  });
+      this->_index[std::make_pair(file, offset)] = block;
+    }
+
+    elle::Buffer
+    HermesTransferBufferer::get(FileID file,
+                                FileOffset offset)
+    {
+      ELLE_DEBUG_SCOPE("%s: get: %s (offset: %s)", *this, file, offset);
+      auto it = this->_index.find(std::make_pair(file, offset));
+      if (it == this->_index.end())
+      {
+        // The block may have been put since.
+        this->_index_refresh();
+        it = this->_index.find(std::make_pair(file, offset));
+      }
+      if (it == this->_index.end())
+      {
+        ELLE_TRACE("Data exhausted on %s/%s", file, offset);
+        throw DataExhausted();
+      }
+      Block block = it->second;
+      elle::Buffer res =
+        this->_fetch(data_file(block.session), block.position, block.size);
+      if (res.size() != block.size)
+      {
+        ELLE_WARN("%s: block %s/%s truncated in session %s",
+                  *this, file, offset, block.session);
+        throw DataExhausted();
+      }
+      return res;
+    }
+
+    TransferBufferer::List
+    HermesTransferBufferer::list()
+    {
+      this->_index_refresh();
+      List res;
+      res.reserve(this->_index.size());
+      for (auto const& block: this->_index)
+        res.push_back(
+          std::make_pair(block.first.first,
+                         std::make_pair(block.first.second,
+                                        block.second.size)));
+      return res;
+    }
+
+    void
+    HermesTransferBufferer::cleanup()
+    {
+      ELLE_TRACE_SCOPE("%s: cleanup", *this);
+      this->_call([&] (RPC& rpc)
+                  {
+                    rpc.remove();
+                  });
+      this->_index.clear();
+      this->_index_read.clear();
+    }
+
+    /*------------.
+    | Connections |
+    `------------*/
+
+    class HermesTransferBufferer::Connection
+    {
+    public:
+      Connection(std::string const& host,
+                 int port,
+                 std::string const& transaction_id):
+        socket(host, boost::lexical_cast<std::string>(port)),
+        serializer(socket),
+        channels(serializer),
+        rpc(channels)
+      {
+        this->rpc.ident(transaction_id);
+      }
+
+      reactor::network::TCPSocket socket;
+      infinit::protocol::Serializer serializer;
+      infinit::protocol::ChanneledStream channels;
+      RPC rpc;
+    };
+
+    void
+    HermesTransferBufferer::_call(std::function<void (RPC&)> const& action)
+    {
+      std::unique_ptr<Connection> connection;
+      while (!connection)
+      {
+        if (!this->_idle.empty())
+        {
+          connection = std::move(this->_idle.back());
+          this->_idle.pop_back();
+        }
+        else if (this->_connections < this->_connections_max)
+        {
+          ++this->_connections;
+          try
+          {
+            ELLE_TRACE("%s: open connection %s",
+                       *this, this->_connections);
+            connection.reset(
+              new Connection(this->_host, this->_port, this->transaction().id));
+          }
+          catch (...)
+          {
+            --this->_connections;
+            this->_released.signal();
+            throw;
+          }
+        }
+        else
+          reactor::wait(this->_released);
+      }
+      bool sane = false;
+      elle::SafeFinally release(
+        [&]
+        {
+          if (sane)
+            this->_idle.push_back(std::move(connection));
+          else
+            --this->_connections;
+          this->_released.signal();
+        });
+      try
+      {
+        action(connection->rpc);
+        sane = true;
+      }
+      catch (reactor::network::Exception const&)
+      {
+        throw;
+      }
+      catch (elle::Exception const&)
+      {
+        // The server answered with an error: the connection is still usable.
+        sane = true;
+        throw;
+      }
+    }
+
+    /*--------.
+    | Storage |
+    `--------*/
+
+    bool
+    HermesTransferBufferer::_exists(FileID id)
+    {
+      return this->_fetch(id, 0, 1).size() > 0;
+    }
+
+    elle::Buffer
+    HermesTransferBufferer::_fetch(FileID id, FileOffset offset, FileSize size)
+    {
+      elle::Buffer res;
+      try
+      {
+        this->_call([&] (RPC& rpc)
+                    {
+                      res = rpc.fetch(id, offset, size);
+                    });
+      }
+      catch (reactor::network::Exception const&)
+      {
+        throw;
+      }
+      catch (elle::Exception const&)
+      {
+        // Nothing stored there.
+        ELLE_DEBUG("%s: nothing stored in %s at %s: %s",
+                   *this, id, offset, elle::exception_string());
+      }
+      return res;
+    }
+
+    void
+    HermesTransferBufferer::_index_refresh()
+    {
+      reactor::Lock lock(this->_refresh_mutex);
+      for (int session = 0; ; ++session)
+      {
+        // Sessions may have stored data and no record yet.
+        if (session == int(this->_index_read.size()))
+        {
+          if (session == this->_session || !this->_exists(data_file(session)))
+            break;
+          this->_index_read.push_back(0);
+        }
+        auto& read = this->_index_read[session];
+        while (true)
+        {
+          elle::Buffer records =
+            this->_fetch(index_file(session), read, fetch_size);
+          FileSize size = records.size() - records.size() % record_size;
+          for (FileSize i = 0; i < size; i += record_size)
+          {
+            unsigned char const* record = records.contents() + i;
+            Block block{session, decode(record + 16), decode(record + 24)};
+            this->_index[std::make_pair(decode(record), decode(record + 8))] =
+              block;
+          }
+          read += size;
+          if (records.size() < fetch_size)
+            break;
+        }
+      }
+      ELLE_TRACE("%s: %s blocks in %s sessions",
+                 *this, this->_index.size(), this->_index_read.size());
+    }
+
+    /*----------.
+    | Printable |
+    `----------*/
+    void
+    HermesTransferBufferer::print(std::ostream& stream) const
+    {
+      stream << "HermesTransferBufferer (transaction_id: "
+             << this->transaction().id << ")";
+    }
+  }
+}
@@ -0,0 +1,183 @@
+#ifndef SURFACE_GAP_HERMES_TRANSFER_BUFFERER_HH
+# define SURFACE_GAP_HERMES_TRANSFER_BUFFERER_HH
+
+# include <map>
+# include <memory>
+# include <vector>
+
+# include <boost/optional.hpp>
+
+# include <elle/attribute.hh>
+# include <elle/serialize/BinaryArchive.hh>
+
+# include <reactor/mutex.hh>
+# include <reactor/signal.hh>
+
+# include <protocol/RPC.hh>
+
+# include <surface/gap/TransferBufferer.hh>
+
+namespace surface
+{
+  namespace gap
+  {
+    /// Buffer transfers on a Hermes server.
+    ///
+    /// Blocks are appended to a data file and recorded in an index file, in
+    /// a new pair of Hermes files each time a sender resumes. Requests go
+    /// through a pool of connections, so that concurrent puts and gets are
+    /// in flight at once.
+    class HermesTransferBufferer:
+      public TransferBufferer
+    {
+    /*------.
+    | Types |
+    `------*/
+    public:
+      typedef HermesTransferBufferer Self;
+      typedef TransferBufferer Super;
+      typedef std::vector<std::pair<std::string, FileSize>> Files;
+      typedef std::pair<std::string, int> Server;
+
+      /// Client side of the Hermes RPCs, declared in the server order.
+      class RPC:
+        public infinit::protocol::RPC<elle::serialize::InputBinaryArchive,
+                                      elle::serialize::OutputBinaryArchive>
+      {
+      public:
+        RPC(infinit::protocol::ChanneledStream& channels);
+        RemoteProcedure<void, std::string> ident;
+        RemoteProcedure<FileSize, FileID, FileOffset, elle::Buffer&> store;
+        RemoteProcedure<elle::Buffer, FileID, FileOffset, FileSize> fetch;
+        RemoteProcedure<void> remove;
+      };
+
+    /*-------------.
+    | Construction |
+    `-------------*/
+    public:
+      /// Recipient constructor.
+      HermesTransferBufferer(infinit::oracles::PeerTransaction& transaction,
+                             std::string const& host,
+                             int port,
+                             int connections = 4);
+      /// Sender constructor.
+      HermesTransferBufferer(infinit::oracles::PeerTransaction& transaction,
+                             std::string const& host,
+                             int port,
+                             FileCount count,
+                             FileSize total_size,
+                             Files const& files,
+                             infinit::cryptography::Code const& key,
+                             int connections = 4);
+      ~HermesTransferBufferer();
+      /// The server set as host:port in INFINIT_CLOUD_HERMES, if any.
+      static
+      boost::optional<Server>
+      server();
+      ELLE_ATTRIBUTE_R(FileCount, count);
+      ELLE_ATTRIBUTE_R(FileSize, full_size);
+      ELLE_ATTRIBUTE_R(Files, files);
+      ELLE_ATTRIBUTE_R(infinit::cryptography::Code, key_code);
+
+    /*------.
+    | Frete |
+    `------*/
+    public:
+      /// Return the path and size of all files.
+      virtual
+      std::vector<std::pair<std::string, FileSize>>
+      files_info() const override;
+      /// Return a weakly crypted chunk of a file.
+      virtual
+      infinit::cryptography::Code
+      read(FileID f, FileOffset start, FileSize size) override;
+      /// Return a strongly crypted chunk of a file.
+      virtual
+      infinit::cryptography::Code
+      encrypted_read(FileID f, FileOffset start, FileSize size) override;
+
+    /*----------.
+    | Buffering |
+    `----------*/
+    public:
+      virtual
+      void
+      put(FileID file,
+          FileOffset offset,
+          FileSize size,
+          elle::ConstWeakBuffer const& b) override;
+      virtual
+      elle::Buffer
+      get(FileID file,
+          FileOffset offset) override;
+      virtual
+      List
+      list() override;
+      virtual
+      void
+      cleanup() override;
+
+    /*------------.
+    | Connections |
+    `------------*/
+    private:
+      class Connection;
+      /// Run action on an idle connection, opening one if the pool allows
+      /// it. Connections failing an action are dropped.
+      void
+      _call(std::function<void (RPC&)> const& action);
+      typedef std::vector<std::unique_ptr<Connection>> Connections;
+      ELLE_ATTRIBUTE(std::string, host);
+      ELLE_ATTRIBUTE(int, port);
+      ELLE_ATTRIBUTE_R(int, connections_max);
+      /// Open connections, idle or not.
+      ELLE_ATTRIBUTE_R(int, connections);
+      ELLE_ATTRIBUTE(Connections, idle);
+      /// Signaled when a connection is given back or dropped.
+      ELLE_ATTRIBUTE(reactor::Signal, released);
+
+    /*--------.
+    | Storage |
+    `--------*/
+    private:
+      /// Location of a buffered block in the data files.
+      struct Block
+      {
+        int session;
+        FileOffset position;
+        FileSize size;
+      };
+      typedef std::map<std::pair<FileID, FileOffset>, Block> Index;
+      /// Whether the first byte of a Hermes file is stored.
+      bool
+      _exists(FileID id);
+      /// Fetch the contiguous bytes of a Hermes file from offset, if any.
+      elle::Buffer
+      _fetch(FileID id, FileOffset offset, FileSize size);
+      /// Read index records stored since the last refresh and discover
+      /// new sessions.
+      void
+      _index_refresh();
+      ELLE_ATTRIBUTE(Index, index);
+      /// Bytes of each session index read so far.
+      ELLE_ATTRIBUTE(std::vector<FileOffset>, index_read);
+      ELLE_ATTRIBUTE(reactor::Mutex, refresh_mutex);
+      /// The session of this sender, -1 for recipients.
+      ELLE_ATTRIBUTE(int, session);
+      /// Next free bytes of the session data and index files.
+      ELLE_ATTRIBUTE(FileOffset, data_position);
+      ELLE_ATTRIBUTE(FileOffset, index_position);
+
+    /*----------.
+    | Printable |
+    `----------*/
+    public:
+      virtual
+      void
+      print(std::ostream& stream) const;
+    };
+  }
+}
+
+#endif
@@ -70,6 +70,13 @@ namespace surface
         throw Exception(gap_error, "an error occured");
     }
 
+    void
+    PeerMachine::_transfer_drain()
+    {
+      // The default transfer operation only answers requests: it ends when
+      // its peer closes the connection.
+    }
+
     void
     PeerMachine::peer_available(
       std::vector<std::pair<std::string, int>> const& local_endpoints,
@@ -57,6 +57,11 @@ namespace surface
       // Just synchronize what you can with cloud
       void
       _cloud_synchronize() = 0;
+      virtual
+      // Stop issuing new requests on the running transfer operation and let it
+      // return once those in flight are done.
+      void
+      _transfer_drain();
       std::unique_ptr<Transferer> _transfer_machine;
       virtual
       void
@@ -29,6 +29,7 @@
 #include <aws/Credentials.hh>
 
 #include <surface/gap/FilesystemTransferBufferer.hh>
+#include <surface/gap/HermesTransferBufferer.hh>
 #include <surface/gap/S3TransferBufferer.hh>
 #include <surface/gap/PeerReceiveMachine.hh>
 #include <surface/gap/State.hh>
@@ -112,6 +113,7 @@ namespace surface
       , _completed(false)
       , _nothing_in_the_cloud(false)
       , _chunk_size(rpc_chunk_size())
+      , _draining(false)
     {
       try
       {
@@ -280,6 +282,7 @@ namespace surface
     PeerReceiveMachine::_transfer_operation(frete::RPCFrete& frete)
     {
       ELLE_TRACE_SCOPE("%s: transfer operation", *this);
+      this->_draining = false;
       elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
       {
         scope.run_background(
@@ -292,6 +295,13 @@ namespace surface
       };
     }
 
+    void
+    PeerReceiveMachine::_transfer_drain()
+    {
+      ELLE_TRACE("%s: drain transfer operation", *this);
+      this->_draining = true;
+    }
+
     void
     PeerReceiveMachine::_cloud_operation()
     {
@@ -340,7 +350,17 @@ namespace surface
         {
           _bufferer.reset(
             new FilesystemTransferBufferer(*this->data(),
-                                           "/tmp/infinit-buffering"));
+                                           elle::os::getenv(
+                                             "INFINIT_CLOUD_FILEBUFFERER_ROOT",
+                                             "/tmp/infinit-buffering")));
+        }
+        else if (auto hermes = HermesTransferBufferer::server())
+        {
+          _bufferer.reset(
+            new HermesTransferBufferer(*this->data(),
+                                       hermes->first,
+                                       hermes->second,
+                                       rpc_pipeline_size()));
         }
         else
         {
@@ -681,6 +701,7 @@ namespace surface
         _store_expected_position = _fetch_current_position;
         // Start processing threads
         bool exception = false;
+        bool drained = false;
         elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
         {
           // Have multiple reader threads, sharing read position
@@ -693,13 +714,24 @@ namespace surface
           bool explicit_ack = peer_version >= elle::Version(0, 8, 9);
           // Prevent unlimited ram buffering if a block fetcher gets stuck
           this->_buffers.max_size(num_reader * 3);
+          int fetching = num_reader;
           for (int i = 0; i < num_reader; ++i)
               scope.run_background(
                 elle::sprintf("transfer reader %s", i),
-                std::bind(&PeerReceiveMachine::_fetcher_thread<Source>,
-                          this, std::ref(source), i, name_policy, explicit_ack,
-                          encryption, this->_chunk_size, std::ref(*key),
-                          files_info));
+                [&, i]
+                {
+                  this->_fetcher_thread<Source>(
+                    source, i, name_policy, explicit_ack, encryption,
+                    this->_chunk_size, *key, files_info);
+                  // Once the last reader stopped on a drain, every block in
+                  // flight is queued: let the writer flush them and stop.
+                  if (--fetching == 0 && this->_draining)
+                  {
+                    this->_disk_writer_barrier.open();
+                    this->_buffers.put(
+                      IndexedBuffer{elle::Buffer(), 0, FileID(-1)});
+                  }
+                });
           scope.run_background(
             "receive writer",
             std::bind(&PeerReceiveMachine::_disk_thread<Source>,
@@ -715,11 +747,25 @@ namespace surface
             this->cancel(elle::sprintf("Filesystem error: %s", e.what()));
             exception = true;
           }
+          if (this->_draining &&
+              this->_store_expected_file != this->_snapshot->count())
+          {
+            ELLE_TRACE("%s: transfer drained at %s/%s", *this,
+                       this->_store_expected_file,
+                       this->_store_expected_position);
+            drained = true;
+            return;
+          }
           clean_snpashot();
           ELLE_TRACE("finish_transfer exited cleanly");
         }; // scope
         if (exception)
           return;
+        if (drained)
+        {
+          this->_draining = false;
+          return;
+        }
       }// if current_transfer
       ELLE_LOG("%s: transfer finished", *this);
       if (peer_version >= elle::Version(0, 8, 7))
@@ -886,6 +932,11 @@ namespace surface
     {
       while (true)
       {
+        if (this->_draining)
+        {
+          ELLE_DEBUG("Thread %s stops fetching on drain", id);
+          break;
+        }
         if (_fetch_current_file_index == -1u)
         {
           ELLE_DEBUG("Thread %s has nothing to do, exiting", id);
@@ -1003,7 +1054,7 @@ namespace surface
           if (data.file_index == FileID(-1))
           {
             ELLE_DEBUG("%s: done writing blocks to disk", *this);
-            break;
+            return;
           }
           const elle::Buffer& buffer = data.buffer;
           ELLE_DEBUG("%s: receiver got data for file %s at position %s with size %s, "
@@ -1080,8 +1131,10 @@ namespace surface
             break; // break to outer while that will wait on barrier
           }
           const IndexedBuffer& next = this->_buffers.peek();
-          if (next.start_position != _store_expected_position
-             || next.file_index != _store_expected_file)
+          // The stop request comes after all blocks, take it right away.
+          if (next.file_index != FileID(-1)
+             && (next.start_position != _store_expected_position
+                 || next.file_index != _store_expected_file))
           {
             _disk_writer_barrier.close();
             break; // break to outer while that will wait on barrier
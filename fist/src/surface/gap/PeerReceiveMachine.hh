@@ -75,6 +75,9 @@ namespace surface
       virtual
       void
       _wait_for_decision() override;
+    protected:
+      void
+      _transfer_drain() override;
 
     /*-----------------------.
     | Machine implementation |
@@ -135,6 +138,7 @@ namespace surface
       ELLE_ATTRIBUTE_R(bool, nothing_in_the_cloud);
       ELLE_ATTRIBUTE(boost::optional<elle::Version>, peer_version);
       ELLE_ATTRIBUTE(std::streamsize const, chunk_size);
+      ELLE_ATTRIBUTE(bool, draining);
       template <typename Source>
       elle::Version const&
       peer_version(Source& source);
@@ -16,6 +16,7 @@
 #include <infinit/oracles/Transaction.hh>
 #include <papier/Identity.hh>
 #include <surface/gap/FilesystemTransferBufferer.hh>
+#include <surface/gap/HermesTransferBufferer.hh>
 #include <surface/gap/S3TransferBufferer.hh>
 #include <surface/gap/State.hh>
 
@@ -714,12 +715,27 @@ namespace surface
         {
           bufferer.reset(
             new FilesystemTransferBufferer(*this->data(),
-                                           "/tmp/infinit-buffering",
+                                           elle::os::getenv(
+                                             "INFINIT_CLOUD_FILEBUFFERER_ROOT",
+                                             "/tmp/infinit-buffering"),
                                            snapshot.count(),
                                            snapshot.total_size(),
                                            files,
                                            frete.key_code()));
         }
+        else if (auto hermes = HermesTransferBufferer::server())
+        {
+          auto const& config = this->transaction().state().configuration();
+          bufferer.reset(
+            new HermesTransferBufferer(*this->data(),
+                                       hermes->first,
+                                       hermes->second,
+                                       snapshot.count(),
+                                       snapshot.total_size(),
+                                       files,
+                                       frete.key_code(),
+                                       config.s3.multipart_upload.parallelism));
+        }
         else
         {
           auto get_credentials = [this] (bool first_time)
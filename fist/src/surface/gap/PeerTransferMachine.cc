@@ -1,11 +1,16 @@
+#include <algorithm>
+
 #include <boost/filesystem.hpp>
 
 #include <elle/container/map.hh>
+#include <elle/finally.hh>
 #include <elle/log.hh>
 #include <elle/network/Interface.hh>
 #include <elle/os/environ.hh>
 
 #include <reactor/network/exception.hh>
+#include <reactor/scheduler.hh>
+#include <reactor/thread.hh>
 
 #include <protocol/exceptions.hh>
 
@@ -20,6 +25,12 @@
 
 ELLE_LOG_COMPONENT("surface.gap.TransferMachine");
 
+/// Delay between the start of two successive connection rounds.
+static reactor::Duration const round_stagger = 500_ms;
+/// Delay between two direct connection attempts while relayed, unless the
+/// peer publishes new endpoints.
+static reactor::Duration const upgrade_probe_interval = 10_sec;
+
 namespace surface
 {
   namespace gap
@@ -27,12 +38,7 @@ namespace surface
     PeerTransferMachine::PeerTransferMachine(PeerMachine& owner)
       : Transferer(owner)
       , _owner(owner)
-      , _station(this->_owner.authority(),
-                 this->_owner.state().passport(),
-                 elle::sprintf("Station(id=%s)", this->_owner.id()))
-      , _upnp(reactor::network::UPNP::make())
-      , _upnp_init_thread(elle::sprintf("%s UPNP init thread", *this),
-                      [this] { this->_upnp_init(); })
+      , _relayed(false)
     {
       ELLE_TRACE("%s: created", *this);
     }
@@ -40,68 +46,21 @@ namespace surface
     PeerTransferMachine::~PeerTransferMachine() noexcept(true)
     {
       ELLE_TRACE("%s: destroyed", *this);
-      this->_upnp_init_thread.terminate_now();
-    }
-
-    void
-    PeerTransferMachine::_upnp_init()
-    {
-      if (this->_owner.state().configuration().disable_upnp
-          || !elle::os::getenv("INFINIT_DISABLE_UPNP", "").empty())
-      {
-        ELLE_TRACE("%s: UPNP support disabled by configuration", *this);
-        return;
-      }
-      // Try to acquire a port mapping for the station port in the background
-      ELLE_TRACE("%s: initialize UPNP", *this)
-        try
-        {
-          this->_upnp->initialize();
-          ELLE_TRACE("%s: UPNP initialized, available=%s",
-                     *this, this->_upnp->available());
-        }
-        // FIXME: use elle::Error
-        catch (reactor::Terminate const&)
-        {
-          throw;
-        }
-        catch (std::exception const& e)
-        {
-          ELLE_LOG("%s: UPNP initialization failed: %s", *this, e.what());
-          return;
-        }
-      ELLE_TRACE("%s: acquire UPNP mapping", *this)
-        try
-        {
-          this->_upnp_mapping =
-            this->_upnp->setup_redirect(reactor::network::Protocol::tcp,
-                                        this->_station.port());
-           ELLE_TRACE("%s: acquired UPNP mapping: %s",
-                      *this, this->_upnp_mapping);
-        }
-        // FIXME: use elle::Error
-        catch (reactor::Terminate const&)
-        {
-          throw;
-        }
-        catch (std::exception const& e)
-        {
-          ELLE_LOG("%s: UPNP mapping failed: %s", *this, e.what());
-          return;
-        }
     }
 
     void
     PeerTransferMachine::_publish_interfaces()
     {
       typedef std::vector<std::pair<std::string, uint16_t>> AddressContainer;
+      auto& station = this->_owner.state().station();
+      auto const& upnp_mapping = this->_owner.state().upnp_mapping();
       AddressContainer addresses;
       // In order to test the fallback, we can fake our local addresses.
       // It should also work for nated network.
       if (elle::os::getenv("INFINIT_LOCAL_ADDRESS", "").length() > 0)
       {
         addresses.emplace_back(elle::os::getenv("INFINIT_LOCAL_ADDRESS"),
-                               this->_station.port());
+                               station.port());
       }
       else
       {
@@ -116,7 +75,7 @@ namespace surface
             if (pair.second.ipv4_address.size() > 0)
             {
               auto const& ipv4 = pair.second.ipv4_address;
-              addresses.emplace_back(ipv4, this->_station.port());
+              addresses.emplace_back(ipv4, station.port());
             }
         }
         catch (elle::Exception const& e)
@@ -129,13 +88,13 @@ namespace surface
       if (elle::os::getenv("INFINIT_UPNP_ADDRESS", "").length() > 0)
       {
         public_addresses.emplace_back(elle::os::getenv("INFINIT_UPNP_ADDRESS"),
-                               this->_station.port());
+                               station.port());
       }
-      else if (this->_upnp_mapping)
+      else if (upnp_mapping)
       {
-        public_addresses.emplace_back(this->_upnp_mapping.external_host,
+        public_addresses.emplace_back(upnp_mapping.external_host,
                                       boost::lexical_cast<unsigned short>(
-                                        this->_upnp_mapping.external_port));
+                                        upnp_mapping.external_port));
       }
       ELLE_DEBUG("addresses: local=%s, public=%s", addresses, public_addresses);
       this->_owner.state().meta().transaction_endpoints_put(
@@ -154,70 +113,205 @@ namespace surface
       auto all_endpoints = this->peer_local_endpoints();
       for (auto const& ep: this->peer_public_endpoints())
         all_endpoints.push_back(ep);
-      rounds.emplace_back(new AddressRound("direct", all_endpoints));
+      auto const& transaction_id = this->_owner.data()->id;
+      auto& station = this->_owner.state().station();
+      rounds.emplace_back(
+        new AddressRound("direct", all_endpoints, transaction_id));
       rounds.emplace_back(new FallbackRound("fallback",
                                             this->_owner.state().meta(),
                                             this->_owner.data()->id));
+      // Both peers race their rounds and could settle on different
+      // connections: the sender picks the winner and confirms it with a byte,
+      // the recipient only keeps a confirmed connection.
+      bool master = this->_owner.is_sender();
+      auto start = boost::posix_time::microsec_clock::universal_time();
+      auto elapsed = [start]
+        {
+          return boost::posix_time::microsec_clock::universal_time() - start;
+        };
       return elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
       {
         reactor::Barrier found;
         std::unique_ptr<station::Host> host;
+        bool confirming = false;
+        // Relay rounds in progress, cancelled on the recipient once a direct
+        // connection was negotiated.
+        std::vector<reactor::Thread*> relays;
+        auto report = [&] (std::string const& method,
+                           boost::posix_time::time_duration const& duration)
+          {
+            bool skip_report = (_attempt > 10 && _attempt % (unsigned)pow(10, (unsigned)log10(_attempt)));
+            if (!skip_report && this->_owner.state().metrics_reporter())
+            {
+              this->_owner.state().metrics_reporter()->transaction_connected(
+                this->_owner.transaction_id(),
+                method,
+                _attempt,
+                duration.total_milliseconds() / 1000.f
+                );
+            }
+          };
+        auto connected = [&] (std::unique_ptr<station::Host> res,
+                              bool relayed,
+                              std::string const& method)
+          {
+            if (!master && !relayed)
+              for (auto relay: relays)
+              {
+                ELLE_DEBUG("%s: direct connection negotiated, cancel %s",
+                           *this, relay->name());
+                relay->terminate();
+              }
+            if (host || confirming)
+            {
+              ELLE_DEBUG("%s: drop late connection %s", *this, *res);
+              return;
+            }
+            try
+            {
+              if (master)
+              {
+                confirming = true;
+                elle::SafeFinally confirmed([&] { confirming = false; });
+                char confirm = 1;
+                res->socket().write(elle::ConstWeakBuffer(&confirm, 1));
+              }
+              else
+                res->socket().read(1);
+            }
+            catch (reactor::network::Exception const& e)
+            {
+              ELLE_DEBUG("%s: %s connection %s was not confirmed: %s",
+                         *this, method, *res, e.what());
+              return;
+            }
+            if (host)
+            {
+              ELLE_DEBUG("%s: drop late connection %s", *this, *res);
+              return;
+            }
+            host = std::move(res);
+            this->_relayed = relayed;
+            found.open();
+            auto duration = elapsed();
+            ELLE_TRACE("%s: connected to peer with %s after %s",
+                       *this, method, duration);
+            report(method, duration);
+          };
         scope.run_background(
           "wait_accepted",
           [&] ()
           {
             ELLE_TRACE_SCOPE("%s: wait for peer connection", *this);
-            std::unique_ptr<station::Host> res =
-              this->_station.accept();
-            ELLE_TRACE("%s: peer connection accepted", *this);
-            ELLE_ASSERT_NEQ(res, nullptr);
-            ELLE_ASSERT_EQ(host, nullptr);
+            while (!host)
+            {
+              std::unique_ptr<station::Host> res =
+                station.accept(transaction_id);
+              ELLE_ASSERT_NEQ(res, nullptr);
+              // Accepted connections are direct ones the peer initiated.
+              connected(std::move(res), false, "direct");
+            }
+          });
+        // Race the rounds, each one starting a bit after the previous one so
+        // the cheapest paths get a head start: (currently direct, apertus).
+        for (unsigned i = 0; i < rounds.size(); ++i)
+        {
+          auto& round = *rounds[i];
+          scope.run_background(
+            elle::sprintf("round %s", round.name()),
+            [&, i]
+            {
+              auto current = reactor::Scheduler::scheduler()->current();
+              if (round.relayed())
+                relays.push_back(current);
+              elle::SafeFinally unregister(
+                [&]
+                {
+                  relays.erase(std::remove(relays.begin(), relays.end(),
+                                           current),
+                               relays.end());
+                });
+              if (i > 0)
+                reactor::sleep(round_stagger * i);
+              ELLE_DEBUG("%s: starting connection round %s", *this, round);
+              std::unique_ptr<station::Host> res = round.connect(station);
+              if (!res)
+              {
+                ELLE_DEBUG("%s: connection round %s failed", *this, round);
+                return;
+              }
+              connected(std::move(res), round.relayed(), round.name());
+            });
+        }
+        reactor::wait(found);
+        ELLE_ASSERT(host != nullptr);
+        return std::move(host);
+      };
+      throw Exception(gap_api_error, "unable to connect to peer");
+    }
+
+    std::unique_ptr<station::Host>
+    PeerTransferMachine::_probe_direct()
+    {
+      ELLE_TRACE_SCOPE("%s: probe direct connection to peer", *this);
+      auto const& transaction_id = this->_owner.data()->id;
+      auto& station = this->_owner.state().station();
+      return elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        reactor::Barrier found;
+        std::unique_ptr<station::Host> host;
+        auto connected = [&] (std::unique_ptr<station::Host> res)
+          {
+            if (host)
+              return;
             host = std::move(res);
             found.open();
+          };
+        // The peer may be the one to reach us.
+        scope.run_background(
+          "wait_accepted",
+          [&]
+          {
+            connected(station.accept(transaction_id));
           });
         scope.run_background(
-          "rounds",
+          "direct probe",
           [&]
           {
-            for (auto& round: rounds)
-            { // try rounds in order: (currently local, upnp, apertus)
-              ELLE_DEBUG("%s: starting connection round %s", *this, *round);
-              std::unique_ptr<station::Host> res;
-              res = round->connect(this->_station);
-              if (res)
+            while (true)
+            {
+              this->peer_endpoints_updated().wait(upgrade_probe_interval);
+              auto endpoints = this->peer_local_endpoints();
+              for (auto const& ep: this->peer_public_endpoints())
+                endpoints.push_back(ep);
+              if (endpoints.empty())
+                continue;
+              AddressRound round("direct", endpoints, transaction_id);
+              if (auto res = round.connect(station))
               {
-                ELLE_ASSERT_EQ(host, nullptr);
-                host = std::move(res);
-                found.open();
-                bool skip_report = (_attempt > 10 && _attempt % (unsigned)pow(10, (unsigned)log10(_attempt)));
-                if (!skip_report && this->_owner.state().metrics_reporter())
-                {
-                  this->_owner.state().metrics_reporter()->transaction_connected(
-                    this->_owner.transaction_id(),
-                    round->name(),
-                    _attempt
-                    );
-                }
-                ELLE_TRACE("%s: connected to peer with %s",
-                           *this, *round);
-                break;
+                connected(std::move(res));
+                return;
               }
-              else
-                ELLE_DEBUG("%s: connection round %s failed", *this, *round);
             }
           });
         reactor::wait(found);
-        ELLE_ASSERT(host != nullptr);
         return std::move(host);
       };
-      throw Exception(gap_api_error, "unable to connect to peer");
     }
 
     void
     PeerTransferMachine::_connection()
     {
       this->_host.reset();
-      this->_host = this->_connect();
+      if (this->_upgrade)
+      {
+        ELLE_TRACE("%s: migrate to direct connection %s",
+                   *this, *this->_upgrade);
+        this->_host = std::move(this->_upgrade);
+        this->_relayed = false;
+      }
+      else
+        this->_host = this->_connect();
       ELLE_TRACE_SCOPE("%s: open peer to peer RPCs", *this);
       this->_serializer.reset(
         new infinit::protocol::Serializer(this->_host->socket()));
@@ -243,13 +337,35 @@ namespace surface
           this->_host.reset();
         }};
       ELLE_ASSERT(this->_rpcs.get());
-      this->_owner._transfer_operation(*this->_rpcs);
+      if (!this->_relayed)
+        this->_owner._transfer_operation(*this->_rpcs);
+      else
+        // Keep looking for a direct path while relayed. Once found, drain the
+        // transfer: requests in flight on the relay complete, no new ones are
+        // issued, and the connection state resumes from the last snapshot on
+        // the direct connection. The peer does likewise when the relay
+        // closes.
+        elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+        {
+          scope.run_background(
+            "upgrade",
+            [&]
+            {
+              this->_upgrade = this->_probe_direct();
+              ELLE_TRACE("%s: direct connection available, drain relay",
+                         *this);
+              this->_owner._transfer_drain();
+            });
+          this->_owner._transfer_operation(*this->_rpcs);
+        };
       ELLE_TRACE_SCOPE("%s: end of transfer operation", *this);
     }
 
     void
     PeerTransferMachine::_stopped()
     {
+      // Hosts the peer connected for this transfer won't be accepted anymore.
+      this->_owner.state().station().forget(this->_owner.data()->id);
     }
 
     void
@@ -271,6 +387,7 @@ namespace surface
       // FIXME: now that _connection starts with a _host.reset, I don't think
       // this is needed anymore.
       this->_host.reset();
+      this->_upgrade.reset();
     }
 
     /*----------.
@@ -1,8 +1,6 @@
 #ifndef SURFACE_GAP_PEER_TRANSFER_MACHINE_HH
 # define SURFACE_GAP_PEER_TRANSFER_MACHINE_HH
 
-# include <reactor/network/upnp.hh>
-
 # include <frete/RPCFrete.hh>
 # include <station/fwd.hh>
 # include <surface/gap/PeerMachine.hh>
@@ -32,16 +30,18 @@ namespace surface
       ELLE_ATTRIBUTE(PeerMachine&, owner);
 
     private:
-      ELLE_ATTRIBUTE(station::Station, station);
-      ELLE_ATTRIBUTE(std::shared_ptr<reactor::network::UPNP>, upnp);
-      ELLE_ATTRIBUTE(reactor::network::PortMapping, upnp_mapping);
-      ELLE_ATTRIBUTE(reactor::Thread, upnp_init_thread);
-      void
-      _upnp_init();
       std::unique_ptr<station::Host>
       _connect();
+      /// Wait until a direct connection with the peer is established, either
+      /// way.
+      std::unique_ptr<station::Host>
+      _probe_direct();
 
-      ELLE_ATTRIBUTE(std::unique_ptr<station::Host>, host); /*stay after station!*/
+      ELLE_ATTRIBUTE(std::unique_ptr<station::Host>, host);
+      /// Whether the current connection goes through a relay.
+      ELLE_ATTRIBUTE(bool, relayed);
+      /// A direct connection found while relayed, to resume the transfer on.
+      ELLE_ATTRIBUTE(std::unique_ptr<station::Host>, upgrade);
 
     protected:
       virtual
@@ -38,10 +38,18 @@ namespace surface
     Round::~Round()
     {}
 
+    bool
+    Round::relayed() const
+    {
+      return false;
+    }
+
     AddressRound::AddressRound(std::string const& name,
-                               Endpoints endpoints)
+                               Endpoints endpoints,
+                               std::string const& transaction_id)
       : Round(name)
       , _endpoints(std::move(endpoints))
+      , _transaction_id(transaction_id)
     {}
 
     std::unique_ptr<station::Host>
@@ -79,8 +87,7 @@ namespace surface
         auto const& port = endpoint.second;
         ELLE_DEBUG("%s: try to negociate connection with %s:%s",
                    *this, ip, port);
-        // XXX: This statement is ok while we are connecting to one peer.
-        auto res = station.connect(ip, port);
+        auto res = station.connect(ip, port, this->_transaction_id);
         ELLE_LOG("%s: connection to %s:%s succeed",
                  *this, ip, port);
         return res;
@@ -146,6 +153,12 @@ namespace surface
       return elle::make_unique<station::Host>(std::move(sock));
     }
 
+    bool
+    FallbackRound::relayed() const
+    {
+      return true;
+    }
+
     void
     FallbackRound::print(std::ostream& stream) const
     {
@@ -32,6 +32,11 @@ namespace surface
       virtual
       std::unique_ptr<station::Host>
       connect(station::Station& station) = 0;
+      /// Whether connections go through a relay instead of straight to the
+      /// peer.
+      virtual
+      bool
+      relayed() const;
 
       ELLE_ATTRIBUTE_R(std::string, name);
     };
@@ -42,11 +47,15 @@ namespace surface
     public:
       typedef std::vector<std::pair<std::string, int>> Endpoints;
       AddressRound(std::string const& name,
-                   Endpoints enpoints);
+                   Endpoints enpoints,
+                   std::string const& transaction_id);
 
       std::unique_ptr<station::Host>
       connect(station::Station& station) override;
       ELLE_ATTRIBUTE(Endpoints, endpoints);
+      /// Transaction the connection is negotiated for, so the shared station
+      /// of the peer routes it to the matching transfer.
+      ELLE_ATTRIBUTE(std::string, transaction_id);
     private:
       std::unique_ptr<station::Host>
       _connect(station::Station& station,
@@ -69,6 +78,8 @@ namespace surface
                     std::string const& uid);
       std::unique_ptr<station::Host>
       connect(station::Station& station) override;
+      bool
+      relayed() const override;
 
     private:
       ELLE_ATTRIBUTE(infinit::oracles::meta::Client const&, meta);
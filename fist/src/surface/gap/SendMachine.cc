@@ -115,13 +115,14 @@ namespace surface
       return progress;
     }
 
-    void
+    uint64_t
     SendMachine::_gcs_plain_upload(boost::filesystem::path const& file_path,
                                    std::string const& initurl)
     {// https://cloud.google.com/storage/docs/concepts-techniques#resumable
       std::string url = initurl;
       ELLE_TRACE("%s: gcs upload on %s", *this, url);
       uint64_t file_size = boost::filesystem::file_size(file_path);
+      uint64_t pushed = 0;
       using reactor::http::StatusCode;
       using reactor::http::Request;
       std::vector<StatusCode> transient = {
@@ -171,7 +172,7 @@ namespace surface
           if (r.status() == StatusCode::OK)
           {
             ELLE_TRACE("%s: Upload reported finished", *this);
-            return;
+            return pushed;
           }
           else if (!status_check(r.status(), r))
             continue;
@@ -187,48 +188,88 @@ namespace surface
           }
           else
             ELLE_TRACE("%s: got no range, starting from the beginning", *this);
-          elle::system::FileHandle file(file_path,
-                                        elle::system::FileHandle::READ);
+          // Disk reads run on worker threads which may outlive this
+          // coroutine if the transfer is cancelled: share the handle with
+          // them and only assign their result once they are done.
+          auto file = std::make_shared<elle::system::FileHandle>(
+            file_path, elle::system::FileHandle::READ);
           // Uploads must be a multiple of 256K
           // We can use huge chunks, an abort mid-chunk will still save the
           // part that was uploaded.
-          static const int chunk_factor = 262144 * 50;
-          while (position < file_size)
-          {
-            bool last = false;
-            uint64_t end = position + chunk_factor;
-            if (end >= file_size)
+          static const int64_t chunk_unit = 262144;
+          int64_t chunk_factor = chunk_unit * 50;
+          auto const& config = this->transaction().state().configuration();
+          auto configured_chunk_size = config.gcs.chunk_size > 0
+            ? config.gcs.chunk_size
+            : config.s3.multipart_upload.chunk_size;
+          if (configured_chunk_size > 0)
+            chunk_factor =
+              (configured_chunk_size + chunk_unit - 1) / chunk_unit * chunk_unit;
+          auto block_end = [&] (uint64_t start)
             {
-              end = file_size;
-              last = true;
-            }
+              return std::min<uint64_t>(start + chunk_factor, file_size);
+            };
+          // The resumable protocol requires blocks in order: overlap sending
+          // a block with reading the next one from disk instead.
+          auto read = [file] (uint64_t start, uint64_t size)
+            {
+              return reactor::background(
+                [file, start, size]
+                {
+                  return file->read(start, size);
+                });
+            };
+          elle::Buffer buffer;
+          if (position < file_size)
+            buffer = read(position, block_end(position) - position);
+          bool failed = false;
+          while (position < file_size && !failed)
+          {
+            uint64_t end = block_end(position);
+            bool last = end == file_size;
             ELLE_DEBUG("%s: pushing %s block %s-%s", *this, last?"last":"", position, end);
-            Request::Configuration conf;
-            conf.stall_timeout(30_sec);
-            conf.timeout(reactor::DurationOpt());
-            conf.header_add("Content-Length",
-                            std::to_string(end - position));
-            std::string endSize = "*";
-            if (last)
-              endSize = std::to_string(file_size);
-            conf.header_add("Content-Range",
-                            elle::sprintf("bytes %s-%s/%s", position, end-1, endSize));
-            auto buffer = file.read(position, end - position);
-            Request r(url, reactor::http::Method::PUT, "application/octet-stream",
-                      conf);
-            r.progress_changed().connect([&](Request::Progress const& p)
-              {
-                this->_plain_progress = float(p.upload_current + position)
-                  / (float)file_size;
-              });
-            r << buffer;
-            r.finalize();
-            reactor::wait(r);
-            if (!status_check(r.status(), r))
-              break;
-            else
+            elle::Buffer next_buffer;
+            elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+            {
+              if (!last)
+                scope.run_background(
+                  elle::sprintf("%s: read block %s", *this, end),
+                  [&]
+                  {
+                    next_buffer = read(end, block_end(end) - end);
+                  });
+              Request::Configuration conf;
+              conf.stall_timeout(30_sec);
+              conf.timeout(reactor::DurationOpt());
+              conf.header_add("Content-Length",
+                              std::to_string(end - position));
+              std::string endSize = "*";
+              if (last)
+                endSize = std::to_string(file_size);
+              conf.header_add("Content-Range",
+                              elle::sprintf("bytes %s-%s/%s", position, end-1, endSize));
+              Request r(url, reactor::http::Method::PUT, "application/octet-stream",
+                        conf);
+              r.progress_changed().connect([&](Request::Progress const& p)
+                {
+                  this->_plain_progress = float(p.upload_current + position)
+                    / (float)file_size;
+                });
+              r << buffer;
+              r.finalize();
+              reactor::wait(r);
+              failed = !status_check(r.status(), r);
+              scope.wait();
+            };
+            if (!failed)
+            {
+              pushed += end - position;
               position = end;
+              buffer = std::move(next_buffer);
+            }
           }
+          if (failed)
+            continue;
           // end reached
           break;
         }
@@ -245,6 +286,35 @@ namespace surface
             std::min(int(500 * pow(2,attempt)), 20000)));
         }
       } // while true
+      return pushed;
+    }
+
+    bool
+    SendMachine::_archive_compress(int64_t total_size)
+    {
+      auto& state = this->transaction().state();
+      auto max_compress_size = state.configuration().max_compress_size;
+      if (max_compress_size == 0)
+        max_compress_size = 10*1000*1000;
+      if (total_size <= max_compress_size)
+        return true;
+      // Above that size, only compress if the archiver keeps up with the
+      // uplink, otherwise compressing costs more time than it saves. Until
+      // both were measured, don't compress large archives.
+      double compression = state.compression_throughput();
+      double upload = state.upload_throughput();
+      if (compression == 0 || upload == 0)
+      {
+        ELLE_TRACE("%s: do not compress archive of %s bytes: "
+                   "throughputs not measured yet", *this, total_size);
+        return false;
+      }
+      bool res = compression >= upload;
+      ELLE_TRACE("%s: %s archive of %s bytes: compression at %sB/s, "
+                 "upload at %sB/s",
+                 *this, res ? "compress" : "do not compress",
+                 total_size, compression, upload);
+      return res;
     }
 
     void
@@ -269,16 +339,24 @@ namespace surface
       // exit information for factored metrics writer.
       // needs to stay out of the try, as catch clause will fill those
       auto start_time = boost::posix_time::microsec_clock::universal_time();
+      // Archiving time must not count in the upload throughput.
+      auto upload_start = start_time;
       metrics::TransferExitReason exit_reason = metrics::TransferExitReasonUnknown;
       std::string exit_message;
       uint64_t total_bytes_transfered = 0;
       elle::SafeFinally write_end_message([&,this]
         {
+          auto now = boost::posix_time::microsec_clock::universal_time();
+          float duration =
+            float((now - start_time).total_milliseconds()) / 1000.0f;
+          float upload_duration =
+            float((now - upload_start).total_milliseconds()) / 1000.0f;
+          if (exit_reason == metrics::TransferExitReasonFinished &&
+              total_bytes_transfered > 0 && upload_duration > 0)
+            this->transaction().state().upload_throughput(
+              total_bytes_transfered / upload_duration);
           if (auto& mr = state().metrics_reporter())
           {
-            auto now = boost::posix_time::microsec_clock::universal_time();
-            float duration =
-              float((now - start_time).total_milliseconds()) / 1000.0f;
             mr->transaction_transfer_end(this->transaction_id(),
                                          metrics::TransferMethodGhostCloud,
                                          duration,
@@ -342,22 +420,27 @@ namespace surface
               };
             ELLE_TRACE("%s: begin archiving thread", *this);
             auto total_size = this->_total_size;
-            auto max_compress_size =
-              this->transaction().state().configuration().max_compress_size;
-            if (max_compress_size == 0)
-              max_compress_size = 10*1000*1000;
+            bool compress = this->_archive_compress(total_size);
+            auto archive_start =
+              boost::posix_time::microsec_clock::universal_time();
             reactor::background(
-              [total_size, max_compress_size,
-               sources, archive_path, renaming_callback]
+              [compress, sources, archive_path, renaming_callback]
               {
                 elle::archive::archive(
-                  total_size <= max_compress_size
+                  compress
                   ? elle::archive::Format::zip
                   : elle::archive::Format::zip_uncompressed,
                   sources, archive_path, renaming_callback);
               });
             ELLE_TRACE("%s: join archiving thread", *this)
               this->transaction().archived(true);
+            auto archive_duration =
+              boost::posix_time::microsec_clock::universal_time() -
+              archive_start;
+            if (compress && archive_duration.total_milliseconds() > 0)
+              this->transaction().state().compression_throughput(
+                double(total_size) * 1000 /
+                archive_duration.total_milliseconds());
           }
           else
           {
@@ -369,13 +452,15 @@ namespace surface
           source_file_path = *this->_files.begin();
         ELLE_TRACE("%s: will ghost-cloud-upload %s of size %s",
                    *this, source_file_path, file_size);
+        upload_start = boost::posix_time::microsec_clock::universal_time();
         auto credentials = this->_cloud_credentials(true);
         auto gcs_creds
           = dynamic_cast<infinit::oracles::meta::CloudCredentialsGCS*>(credentials.get());
         if (gcs_creds)
         {
           // Google upload
-          _gcs_plain_upload(source_file_path, gcs_creds->url());
+          total_bytes_transfered =
+            _gcs_plain_upload(source_file_path, gcs_creds->url());
           exit_reason = metrics::TransferExitReasonFinished;
           return;
         }
@@ -403,9 +488,6 @@ namespace surface
         ELLE_TRACE("%s: using chunk size of %s, with %s chunks",
                    *this, chunk_size, chunk_count);
         std::vector<aws::S3::MultiPartChunk> chunks;
-        int next_chunk = 0;
-        int max_check_id = 0; // check for chunk presence up to that id
-        int start_check_index = 0; // check for presence from that chunks index
         std::string upload_id;
         if (this->transaction().plain_upload_uid())
         {
@@ -422,23 +504,8 @@ namespace surface
                 return a.first < b.first;
               });
             ELLE_DEBUG("chunks: %s", chunks);
-            if (!chunks.empty())
-            {
-              // We expect missing blocks potentially, but only at the end
-              //, ie we expect contiguous blocks 0 to (num_blocks - pipeline_size)
-              for (int i = 0; i < int(chunks.size()); ++i)
-                if (chunks[i].first != i)
-                  break;
-                else
-                  next_chunk = i+1;
-              start_check_index = next_chunk;
-              max_check_id = chunks.back().first;
-            }
-            else
-            {
+            if (chunks.empty())
               ELLE_DEBUG("no chunks found");
-            }
-            ELLE_DEBUG("will resume at chunk %s", next_chunk);
           }
           catch (aws::AWSException const& e)
           {
@@ -471,8 +538,22 @@ namespace surface
           ELLE_TRACE("%s: saved upload ID %s to snapshot",
                      *this, *this->transaction().plain_upload_uid());
         }
-        ELLE_DEBUG("next chunk to be uploaded: %s", next_chunk);
-        auto chunk_uploaded = next_chunk;
+        // Chunks already present remotely, and the queue of the missing ones
+        // upload threads pull from.
+        std::vector<bool> present(chunk_count, false);
+        for (auto const& chunk: chunks)
+          if (chunk.first >= 0 && chunk.first < chunk_count)
+            present[chunk.first] = true;
+        std::vector<int> missing;
+        missing.reserve(chunk_count);
+        for (int i = 0; i < chunk_count; ++i)
+          if (!present[i])
+            missing.push_back(i);
+        auto next_missing = missing.begin();
+        ELLE_DEBUG("%s chunks to be uploaded, starting at %s",
+                   missing.size(),
+                   missing.empty() ? chunk_count : missing.front());
+        int chunk_uploaded = chunk_count - missing.size();
         this->_plain_progress =
           float(chunk_uploaded) / float(chunk_count);
         if (auto& mr = state().metrics_reporter())
@@ -491,25 +572,9 @@ namespace surface
           while (true)
           {
             // fetch a chunk number
-            if (next_chunk >= chunk_count)
+            if (next_missing == missing.end())
               return;
-            int local_chunk = next_chunk++;
-            if (local_chunk <= max_check_id)
-            { // maybe we have it
-              bool has_it = false;
-              for (unsigned i = start_check_index;
-                   i < chunks.size() && chunks[i].first <= max_check_id;
-                   ++i)
-              {
-                if (chunks[i].first == local_chunk)
-                {
-                  has_it = true;
-                  break;
-                }
-              }
-              if (has_it)
-                continue;
-            }
+            int local_chunk = *next_missing++;
             // upload it
             ELLE_DEBUG("%s: uploading chunk %s", *this, local_chunk);
             auto buffer = file.read((int64_t)local_chunk * (int64_t)chunk_size, chunk_size);
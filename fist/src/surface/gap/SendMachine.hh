@@ -45,8 +45,13 @@ namespace surface
       // cleartext upload one file to cloud
       void
       _plain_upload();
-      void
+      /// \return The number of bytes sent.
+      uint64_t
       _gcs_plain_upload(boost::filesystem::path const& file_path, std::string const&url);
+      /// Whether archiving total_size bytes should be compressed, given the
+      /// compression and upload throughputs observed so far.
+      bool
+      _archive_compress(int64_t total_size);
       ELLE_ATTRIBUTE(float, plain_progress);
       typedef std::unordered_map<int, float> PlainProgressChunks;
       ELLE_ATTRIBUTE(PlainProgressChunks, plain_progress_chunks);
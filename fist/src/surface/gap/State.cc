@@ -26,6 +26,8 @@
 #include <papier/Passport.hh>
 #include <papier/Authority.hh>
 
+#include <station/Station.hh>
+
 #include <infinit/metrics/Reporter.hh>
 #include <infinit/oracles/trophonius/Client.hh>
 
@@ -149,6 +151,8 @@ namespace surface
       , _device_uuid(std::move(local_config.device_id()))
       , _device()
       , _login_watcher_thread(nullptr)
+      , _compression_throughput(0)
+      , _upload_throughput(0)
       , _authority(local_config.authority())
     {
       this->_logged_out.open();
@@ -168,6 +172,7 @@ namespace surface
       config.s3.multipart_upload.parallelism = 8;
 #endif
       config.s3.multipart_upload.chunk_size = 0;
+      config.gcs.chunk_size = 0;
       config.enable_file_mirroring =
         this->local_configuration().enable_mirroring();
       config.max_mirror_size = this->local_configuration().max_mirror_size();
@@ -937,6 +942,18 @@ namespace surface
           ELLE_DEBUG("clear transactions")
             this->_transactions_clear();
 
+          ELLE_DEBUG("clear station")
+          {
+            if (this->_upnp_init_thread)
+            {
+              this->_upnp_init_thread->terminate_now();
+              this->_upnp_init_thread.reset();
+            }
+            this->_upnp_mapping = reactor::network::PortMapping();
+            this->_upnp.reset();
+            this->_station.reset();
+          }
+
           ELLE_DEBUG("clear users")
           {
             this->_user_indexes.clear();
@@ -1435,6 +1452,76 @@ namespace surface
       }
     }
 
+    /*--------.
+    | Station |
+    `--------*/
+
+    station::Station&
+    State::station()
+    {
+      if (!this->_station)
+      {
+        ELLE_TRACE_SCOPE("%s: create station", *this);
+        this->_station.reset(
+          new station::Station(this->authority(),
+                               this->passport(),
+                               elle::sprintf("Station(%s)", *this)));
+        this->_upnp_init_thread.reset(
+          new reactor::Thread(elle::sprintf("%s UPNP init thread", *this),
+                              [this] { this->_upnp_init(); }));
+      }
+      return *this->_station;
+    }
+
+    void
+    State::_upnp_init()
+    {
+      if (this->configuration().disable_upnp
+          || !elle::os::getenv("INFINIT_DISABLE_UPNP", "").empty())
+      {
+        ELLE_TRACE("%s: UPNP support disabled by configuration", *this);
+        return;
+      }
+      this->_upnp = reactor::network::UPNP::make();
+      // Try to acquire a port mapping for the station port in the background
+      ELLE_TRACE("%s: initialize UPNP", *this)
+        try
+        {
+          this->_upnp->initialize();
+          ELLE_TRACE("%s: UPNP initialized, available=%s",
+                     *this, this->_upnp->available());
+        }
+        // FIXME: use elle::Error
+        catch (reactor::Terminate const&)
+        {
+          throw;
+        }
+        catch (std::exception const& e)
+        {
+          ELLE_LOG("%s: UPNP initialization failed: %s", *this, e.what());
+          return;
+        }
+      ELLE_TRACE("%s: acquire UPNP mapping", *this)
+        try
+        {
+          this->_upnp_mapping =
+            this->_upnp->setup_redirect(reactor::network::Protocol::tcp,
+                                        this->_station->port());
+           ELLE_TRACE("%s: acquired UPNP mapping: %s",
+                      *this, this->_upnp_mapping);
+        }
+        // FIXME: use elle::Error
+        catch (reactor::Terminate const&)
+        {
+          throw;
+        }
+        catch (std::exception const& e)
+        {
+          ELLE_LOG("%s: UPNP mapping failed: %s", *this, e.what());
+          return;
+        }
+    }
+
     /*--------------.
     | Configuration |
     `--------------*/
@@ -1443,6 +1530,7 @@ namespace surface
     State::Configuration::serialize(elle::serialization::Serializer& s)
     {
       s.serialize("s3", this->s3);
+      s.serialize("gcs", this->gcs);
       s.serialize("enable_file_mirroring", this->enable_file_mirroring);
       s.serialize("max_mirror_size", this->max_mirror_size);
       s.serialize("max_compress_size", this->max_compress_size);
@@ -1465,6 +1553,12 @@ namespace surface
       s.serialize("parallelism", this->parallelism);
     }
 
+    void
+    State::Configuration::GCS::serialize(elle::serialization::Serializer& s)
+    {
+      s.serialize("chunk_size", this->chunk_size);
+    }
+
     void
     State::_apply_configuration(elle::json::Object json)
     {
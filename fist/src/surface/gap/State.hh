@@ -19,11 +19,14 @@
 # include <reactor/MultiLockBarrier.hh>
 # include <reactor/thread.hh>
 # include <reactor/network/proxy.hh>
+# include <reactor/network/upnp.hh>
 
 # include <aws/S3.hh>
 
 # include <papier/fwd.hh>
 
+# include <station/fwd.hh>
+
 # include <infinit/metrics/CompositeReporter.hh>
 # include <infinit/oracles/meta/Client.hh>
 # include <infinit/oracles/Transaction.hh>
@@ -441,6 +444,23 @@ namespace surface
       papier::Identity const&
       identity() const;
 
+      /*--------.
+      | Station |
+      `--------*/
+    public:
+      /// The station shared by all peer transfers of the logged user, created
+      /// on first use.
+      station::Station&
+      station();
+      /// The UPNP mapping of the station port, if one was acquired.
+      ELLE_ATTRIBUTE_R(reactor::network::PortMapping, upnp_mapping);
+    private:
+      void
+      _upnp_init();
+      ELLE_ATTRIBUTE(std::unique_ptr<station::Station>, station);
+      ELLE_ATTRIBUTE(std::shared_ptr<reactor::network::UPNP>, upnp);
+      ELLE_ATTRIBUTE(std::unique_ptr<reactor::Thread>, upnp_init_thread);
+
     public:
       /// Check if the local device has been created.
       bool
@@ -852,10 +872,17 @@ namespace surface
           void serialize(elle::serialization::Serializer& s);
         };
         S3 s3;
+        struct GCS
+        {
+          /// Resumable upload block size, 0 to use the S3 chunk size.
+          int chunk_size;
+          void serialize(elle::serialization::Serializer& s);
+        };
+        GCS gcs;
         void serialize(elle::serialization::Serializer& s);
         bool enable_file_mirroring; // Only copy files if this is true.
         int64_t max_mirror_size; // Copy files to send if below this size
-        int64_t max_compress_size; // Only compresss archive if content below this size
+        int64_t max_compress_size; // Always compress archive if content below this size
         int64_t max_cloud_buffer_size; // Only cloud buffer below this size
         bool disable_upnp;
         typedef std::unordered_map<std::string, std::string> Features;
@@ -869,6 +896,17 @@ namespace surface
       void
       _apply_configuration(elle::json::Object json);
 
+    /*-----------.
+    | Throughput |
+    `-----------*/
+    public:
+      /// Archive compression rate last observed on this host, in bytes per
+      /// second, or 0 if unknown.
+      ELLE_ATTRIBUTE_RW(double, compression_throughput);
+      /// Cloud upload rate last observed from this host, in bytes per second,
+      /// or 0 if unknown.
+      ELLE_ATTRIBUTE_RW(double, upload_throughput);
+
     /*------.
     | Model |
     `------*/
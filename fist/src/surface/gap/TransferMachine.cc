@@ -453,6 +453,7 @@ namespace surface
                        public_endpoints);
       this->_peer_local_endpoints = local_endpoints;
       this->_peer_public_endpoints = public_endpoints;
+      this->_peer_endpoints_updated.signal();
       this->_peer_unreachable.close();
       this->_peer_reachable.open();
     }
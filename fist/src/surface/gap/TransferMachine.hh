@@ -3,6 +3,7 @@
 
 # include <reactor/Barrier.hh>
 # include <reactor/fsm.hh>
+# include <reactor/signal.hh>
 # include <reactor/timer.hh>
 
 # include <surface/gap/fwd.hh>
@@ -56,6 +57,8 @@ namespace surface
       typedef std::vector<std::pair<std::string, int>> Endpoints;
       ELLE_ATTRIBUTE_R(Endpoints, peer_local_endpoints);
       ELLE_ATTRIBUTE_R(Endpoints, peer_public_endpoints);
+      // Signaled when the peer publishes new endpoints.
+      ELLE_ATTRIBUTE_RX(reactor::Signal, peer_endpoints_updated);
       // Number of connection attempts so far
       ELLE_ATTRIBUTE_RP(int, attempt, protected:);
       // Timer for delayed gap transaction transitionning to connecting
@@ -0,0 +1,105 @@
+#include <boost/filesystem/fstream.hpp>
+
+#include <elle/filesystem/TemporaryDirectory.hh>
+#include <elle/log.hh>
+#include <elle/memory.hh>
+#include <elle/test.hh>
+
+#include <surface/gap/FilesystemTransferBufferer.hh>
+
+ELLE_LOG_COMPONENT("surface.gap.FilesystemTransferBufferer.test");
+
+using surface::gap::FilesystemTransferBufferer;
+using surface::gap::TransferBufferer;
+
+static
+elle::Buffer
+block(char c, int size)
+{
+  elle::Buffer res(size);
+  memset(res.mutable_contents(), c, size);
+  return res;
+}
+
+ELLE_TEST_SCHEDULED(put_get_list)
+{
+  elle::filesystem::TemporaryDirectory root;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  FilesystemTransferBufferer::Files files{{"a", 2048}, {"b", 1024}};
+  FilesystemTransferBufferer sender(
+    transaction, root.path(), 2, 3072, files, infinit::cryptography::Code());
+  sender.put(0, 0, 1024, block('a', 1024));
+  sender.put(0, 1024, 1024, block('b', 1024));
+  sender.put(1, 0, 1024, block('c', 1024));
+  BOOST_CHECK_EQUAL(sender.get(0, 1024), block('b', 1024));
+  BOOST_CHECK_THROW(sender.get(1, 1024), TransferBufferer::DataExhausted);
+  BOOST_CHECK_EQUAL(sender.list().size(), 3);
+  // A recipient sees blocks put before and after it was opened.
+  FilesystemTransferBufferer recipient(transaction, root.path());
+  BOOST_CHECK_EQUAL(recipient.count(), 2);
+  BOOST_CHECK_EQUAL(recipient.list().size(), 3);
+  BOOST_CHECK_EQUAL(recipient.get(0, 0), block('a', 1024));
+  sender.put(1, 1024, 512, block('d', 512));
+  BOOST_CHECK_EQUAL(recipient.get(1, 1024), block('d', 512));
+  recipient.cleanup();
+  BOOST_CHECK(!exists(root.path() / transaction.id));
+}
+
+ELLE_TEST_SCHEDULED(segments)
+{
+  elle::filesystem::TemporaryDirectory root;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  auto size = FilesystemTransferBufferer::segment_size_max / 2 + 1;
+  {
+    FilesystemTransferBufferer sender(
+      transaction, root.path(), 1, 3 * size, {{"a", 3 * size}},
+      infinit::cryptography::Code());
+    for (int i = 0; i < 3; ++i)
+      sender.put(0, i * size, size, block('a' + i, size));
+  }
+  BOOST_CHECK(exists(root.path() / transaction.id / "segment.2"));
+  // Reopen and check every block is still indexed.
+  FilesystemTransferBufferer recipient(transaction, root.path());
+  BOOST_CHECK_EQUAL(recipient.list().size(), 3);
+  for (int i = 0; i < 3; ++i)
+    BOOST_CHECK_EQUAL(recipient.get(0, i * size), block('a' + i, size));
+}
+
+// Data written before a crash but never indexed is skipped, not overwritten
+// nor mistaken for blocks.
+ELLE_TEST_SCHEDULED(unindexed)
+{
+  elle::filesystem::TemporaryDirectory root;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  auto sender = [&]
+    {
+      return elle::make_unique<FilesystemTransferBufferer>(
+        transaction, root.path(), 1, 4096,
+        FilesystemTransferBufferer::Files{{"a", 4096}},
+        infinit::cryptography::Code());
+    };
+  sender()->put(0, 0, 1024, block('a', 1024));
+  {
+    boost::filesystem::ofstream garbage(
+      root.path() / transaction.id / "segment.0",
+      std::ios_base::app | std::ios_base::binary);
+    garbage << std::string(100, 'x');
+  }
+  sender()->put(0, 1024, 1024, block('b', 1024));
+  FilesystemTransferBufferer recipient(transaction, root.path());
+  BOOST_CHECK_EQUAL(recipient.list().size(), 2);
+  BOOST_CHECK_EQUAL(recipient.get(0, 0), block('a', 1024));
+  BOOST_CHECK_EQUAL(recipient.get(0, 1024), block('b', 1024));
+}
+
+ELLE_TEST_SUITE()
+{
+  auto timeout = RUNNING_ON_VALGRIND ? 60 : 15;
+  auto& suite = boost::unit_test::framework::master_test_suite();
+  suite.add(BOOST_TEST_CASE(put_get_list), 0, timeout);
+  suite.add(BOOST_TEST_CASE(segments), 0, timeout);
+  suite.add(BOOST_TEST_CASE(unindexed), 0, timeout);
+}
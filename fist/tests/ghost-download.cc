@@ -1,9 +1,17 @@
+#include <algorithm>
 #include <fstream>
 #include <elle/filesystem/TemporaryFile.hh>
 #include <elle/log.hh>
 #include <elle/test.hh>
 #include <elle/Buffer.hh>
 #include <elle/archive/archive.hh>
+#include <elle/utility/Move.hh>
+
+#include <reactor/Scope.hh>
+#include <reactor/network/exception.hh>
+#include <reactor/network/tcp-server.hh>
+#include <reactor/network/tcp-socket.hh>
+#include <reactor/thread.hh>
 
 #include <surface/gap/Exception.hh>
 #include <surface/gap/State.hh>
@@ -242,6 +250,221 @@ ELLE_TEST_SCHEDULED(automatic_unzip)
   }
 }
 
+/// HTTP server for a ghost archive, honoring Range requests unless told
+/// otherwise.
+class RangeServer
+{
+public:
+  typedef std::pair<int64_t, int64_t> Range;
+
+  RangeServer(std::string content, bool ranges = true)
+    : cut(0)
+    , cut_range()
+    , content(std::move(content))
+    , ranges(ranges)
+    , requests()
+    , _server()
+    , _accepter("range server accepter",
+                std::bind(&RangeServer::_accept, this))
+  {
+    this->_server.listen();
+  }
+
+  ~RangeServer()
+  {
+    this->_accepter.terminate_now();
+  }
+
+  std::string
+  url(std::string const& name) const
+  {
+    return elle::sprintf("http://127.0.0.1:%s/%s", this->_server.port(), name);
+  }
+
+  /// Drop the next ranged request after that many bytes, 0 for none.
+  int64_t cut;
+  /// The request that was dropped.
+  Range cut_range;
+  std::string const content;
+  bool const ranges;
+  /// Requested ranges, [first, second).
+  std::vector<Range> requests;
+
+private:
+  void
+  _accept()
+  {
+    elle::With<reactor::Scope>() << [this] (reactor::Scope& scope)
+    {
+      while (true)
+      {
+        auto socket = elle::utility::move_on_copy(this->_server.accept());
+        scope.run_background(
+          "serve",
+          [socket, this]
+          {
+            try
+            {
+              this->_serve(std::move(*socket));
+            }
+            catch (reactor::network::Exception const&)
+            {}
+          });
+      }
+    };
+  }
+
+  void
+  _serve(std::unique_ptr<reactor::network::TCPSocket> socket)
+  {
+    static std::string const prefix = "Range: bytes=";
+    int64_t const size = this->content.size();
+    Range range(0, size);
+    bool ranged = false;
+    std::string line;
+    std::getline(*socket, line);
+    while (std::getline(*socket, line) && line != "\r" && !line.empty())
+    {
+      if (line.compare(0, prefix.size(), prefix) != 0)
+        continue;
+      auto dash = line.find('-', prefix.size());
+      range.first =
+        std::stoll(line.substr(prefix.size(), dash - prefix.size()));
+      auto last = line.substr(dash + 1);
+      if (!last.empty() && last != "\r")
+        range.second = std::stoll(last) + 1;
+      ranged = this->ranges;
+    }
+    ELLE_LOG("serve %s-%s", range.first, range.second);
+    this->requests.push_back(range);
+    if (!ranged)
+      range = Range(0, size);
+    int64_t send = range.second - range.first;
+    if (ranged && this->cut > 0 && send > 1)
+    {
+      send = std::min(send, this->cut);
+      this->cut = 0;
+      this->cut_range = range;
+    }
+    std::string header = ranged
+      ? elle::sprintf("HTTP/1.1 206 Partial Content\r\n"
+                      "Content-Range: bytes %s-%s/%s\r\n",
+                      range.first, range.second - 1, size)
+      : std::string("HTTP/1.1 200 OK\r\n");
+    header += elle::sprintf("Content-Length: %s\r\n"
+                            "Connection: close\r\n\r\n",
+                            range.second - range.first);
+    socket->write(elle::ConstWeakBuffer(header.data(), header.size()));
+    socket->write(
+      elle::ConstWeakBuffer(this->content.data() + range.first, send));
+  }
+
+  reactor::network::TCPServer _server;
+  reactor::Thread _accepter;
+};
+
+static
+std::string
+range_content()
+{
+  // Large enough for several 4 MiB ranges, with bytes telling their offset.
+  std::string res(12 * 1024 * 1024, 0);
+  for (unsigned i = 0; i < res.size(); ++i)
+    res[i] = i % 251;
+  return res;
+}
+
+/// Accept a ghost transaction downloading url and return the file received.
+static
+std::string
+ghost_receive(std::string const& url)
+{
+  tests::Server server;
+  auto const email = "em@il.com";
+  auto const password = "secret";
+  auto& sender = server.register_user("sender@infinit.io", password);
+  auto& user = server.register_user(email, password);
+  tests::State state(server, elle::UUID::random());
+  auto t = std::make_shared<tests::Transaction>();
+  t->recipient_id = user.id().repr();
+  t->sender_id = sender.id().repr();
+  t->is_ghost = true;
+  t->download_link = url;
+  t->status = infinit::oracles::Transaction::Status::ghost_uploaded;
+  server.transactions().insert(t);
+  reactor::Barrier finished;
+  state->attach_callback<surface::gap::PeerTransaction>(
+    [&] (surface::gap::PeerTransaction const& transaction)
+    {
+      auto status = transaction.status;
+      ELLE_LOG("new transaction status: %s", status);
+      switch (status)
+      {
+        case gap_transaction_waiting_accept:
+          state->transactions().at(transaction.id)->accept();
+          break;
+        case gap_transaction_transferring:
+          break;
+        case gap_transaction_finished:
+          finished.open();
+          break;
+        default:
+          BOOST_ERROR(elle::sprintf("unexpected GAP status: %s", status));
+      }
+    });
+  state->login(email, password);
+  while (!finished)
+  {
+    reactor::sleep(100_ms);
+    state->poll();
+  }
+  auto path = state.download_dir().path() / "ghost.bin";
+  boost::filesystem::ifstream file(path, std::ios_base::binary);
+  return std::string(std::istreambuf_iterator<char>(file),
+                     std::istreambuf_iterator<char>());
+}
+
+// Download a ghost archive in several ranges at once.
+ELLE_TEST_SCHEDULED(ranges)
+{
+  RangeServer server(range_content());
+  BOOST_CHECK(ghost_receive(server.url("ghost.bin")) == server.content);
+  // The probe and at least two ranges.
+  BOOST_CHECK_GE(server.requests.size(), 3);
+  BOOST_CHECK(server.requests[0] == RangeServer::Range(0, 1));
+  for (unsigned i = 1; i < server.requests.size(); ++i)
+    BOOST_CHECK_LT(server.requests[i].second - server.requests[i].first,
+                   int64_t(server.content.size()));
+}
+
+// An interrupted range resumes where it stopped.
+ELLE_TEST_SCHEDULED(ranges_resume)
+{
+  RangeServer server(range_content());
+  int64_t const cut = 1024 * 1024;
+  server.cut = cut;
+  BOOST_CHECK(ghost_receive(server.url("ghost.bin")) == server.content);
+  // The cut range was requested again from where it stopped, to its end.
+  auto resumed = RangeServer::Range(server.cut_range.first + cut,
+                                    server.cut_range.second);
+  BOOST_CHECK(std::find(server.requests.begin(), server.requests.end(),
+                        resumed) != server.requests.end());
+  // The ranges were resumed from the checkpoint, not probed again.
+  BOOST_CHECK_EQUAL(
+    std::count(server.requests.begin(), server.requests.end(),
+               RangeServer::Range(0, 1)),
+    1);
+}
+
+// Servers ignoring ranges are downloaded from sequentially.
+ELLE_TEST_SCHEDULED(ranges_unsupported)
+{
+  RangeServer server(range_content(), false);
+  BOOST_CHECK(ghost_receive(server.url("ghost.bin")) == server.content);
+  // The probe and the sequential download.
+  BOOST_CHECK_EQUAL(server.requests.size(), 2);
+}
+
 ELLE_TEST_SUITE()
 {
   auto timeout = RUNNING_ON_VALGRIND ? 60 : 15;
@@ -249,4 +472,7 @@ ELLE_TEST_SUITE()
   suite.add(BOOST_TEST_CASE(ghost_download), 0, timeout);
   suite.add(BOOST_TEST_CASE(wait_for_data), 0, timeout);
   suite.add(BOOST_TEST_CASE(automatic_unzip), 0, timeout);
+  suite.add(BOOST_TEST_CASE(ranges), 0, timeout);
+  suite.add(BOOST_TEST_CASE(ranges_resume), 0, timeout);
+  suite.add(BOOST_TEST_CASE(ranges_unsupported), 0, timeout);
 }
@@ -0,0 +1,346 @@
+#include <ctime>
+#include <unordered_map>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <elle/filesystem/TemporaryDirectory.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+#include <elle/memory.hh>
+#include <elle/test.hh>
+#include <elle/utility/Move.hh>
+
+#include <reactor/Scope.hh>
+#include <reactor/network/exception.hh>
+#include <reactor/network/tcp-server.hh>
+#include <reactor/network/tcp-socket.hh>
+#include <reactor/scheduler.hh>
+#include <reactor/thread.hh>
+
+#include <protocol/ChanneledStream.hh>
+#include <protocol/Serializer.hh>
+
+#include <infinit/oracles/hermes/Hermes.hh>
+
+#include <surface/gap/HermesTransferBufferer.hh>
+
+ELLE_LOG_COMPONENT("surface.gap.HermesTransferBufferer.test");
+
+using surface::gap::HermesTransferBufferer;
+using surface::gap::TransferBufferer;
+typedef TransferBufferer::FileSize FileSize;
+
+static
+elle::Buffer
+block(char c, int size)
+{
+  elle::Buffer res(size);
+  memset(res.mutable_contents(), c, size);
+  return res;
+}
+
+/// In memory Hermes: keeps the first bytes stored at each position and
+/// fetches contiguous bytes.
+class Hermes
+{
+public:
+  typedef TransferBufferer::FileID FileID;
+  typedef TransferBufferer::FileOffset FileOffset;
+
+  Hermes()
+    : connections(0)
+    , connections_max(0)
+    , _server()
+    , _files()
+    , _accepter("hermes accepter",
+                std::bind(&Hermes::_accept, this))
+  {
+    this->_server.listen();
+  }
+
+  ~Hermes()
+  {
+    this->_accepter.terminate_now();
+  }
+
+  int
+  port() const
+  {
+    return this->_server.port();
+  }
+
+  int connections;
+  int connections_max;
+
+private:
+  void
+  _accept()
+  {
+    elle::With<reactor::Scope>() << [this] (reactor::Scope& scope)
+    {
+      while (true)
+      {
+        auto socket = elle::utility::move_on_copy(this->_server.accept());
+        scope.run_background(
+          "serve",
+          [socket, this]
+          {
+            this->_serve(std::move(*socket));
+          });
+      }
+    };
+  }
+
+  void
+  _serve(std::unique_ptr<reactor::network::TCPSocket> socket)
+  {
+    ++this->connections;
+    this->connections_max =
+      std::max(this->connections, this->connections_max);
+    elle::SafeFinally count([this] { --this->connections; });
+    infinit::protocol::Serializer serializer(*socket);
+    infinit::protocol::ChanneledStream channels(serializer);
+    HermesTransferBufferer::RPC rpc(channels);
+    rpc.ident = [] (std::string const&) {};
+    rpc.store = [this] (FileID id, FileOffset off, elle::Buffer& data)
+      {
+        auto& file = this->_files[id];
+        if (file.first.size() < off + data.size())
+        {
+          file.first.resize(off + data.size());
+          file.second.resize(off + data.size());
+        }
+        for (FileSize i = 0; i < data.size(); ++i)
+          if (!file.second[off + i])
+          {
+            file.first[off + i] = data.contents()[i];
+            file.second[off + i] = true;
+          }
+        return FileSize(data.size());
+      };
+    rpc.fetch = [this] (FileID id, FileOffset off, FileSize size)
+      {
+        auto it = this->_files.find(id);
+        if (it == this->_files.end() ||
+            off >= it->second.first.size() || !it->second.second[off])
+          throw elle::Exception("Chunk not found");
+        auto const& file = it->second;
+        FileOffset end = off;
+        while (end < off + size && end < file.first.size() &&
+               file.second[end])
+          ++end;
+        return elle::Buffer(file.first.data() + off, end - off);
+      };
+    rpc.remove = [this] ()
+      {
+        this->_files.clear();
+      };
+    try
+    {
+      rpc.run();
+    }
+    catch (reactor::network::Exception const&)
+    {}
+  }
+
+  reactor::network::TCPServer _server;
+  /// Bytes of each file and whether they are stored.
+  typedef std::pair<std::vector<unsigned char>, std::vector<bool>> File;
+  std::unordered_map<FileID, File> _files;
+  reactor::Thread _accepter;
+};
+
+ELLE_TEST_SCHEDULED(put_get_list)
+{
+  Hermes hermes;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  BOOST_CHECK_THROW(
+    HermesTransferBufferer(transaction, "127.0.0.1", hermes.port()),
+    TransferBufferer::DataExhausted);
+  HermesTransferBufferer::Files files{{"a", 2048}, {"b", 1024}};
+  HermesTransferBufferer sender(
+    transaction, "127.0.0.1", hermes.port(), 2, 3072, files,
+    infinit::cryptography::Code());
+  sender.put(0, 0, 1024, block('a', 1024));
+  sender.put(0, 1024, 1024, block('b', 1024));
+  sender.put(1, 0, 1024, block('c', 1024));
+  BOOST_CHECK_EQUAL(sender.get(0, 1024), block('b', 1024));
+  BOOST_CHECK_THROW(sender.get(1, 1024), TransferBufferer::DataExhausted);
+  BOOST_CHECK_EQUAL(sender.list().size(), 3);
+  // A recipient sees blocks put before and after it was opened.
+  HermesTransferBufferer recipient(transaction, "127.0.0.1", hermes.port());
+  BOOST_CHECK_EQUAL(recipient.count(), 2);
+  BOOST_CHECK_EQUAL(recipient.full_size(), 3072);
+  BOOST_CHECK_EQUAL(recipient.files_info().size(), 2);
+  BOOST_CHECK_EQUAL(recipient.list().size(), 3);
+  BOOST_CHECK_EQUAL(recipient.get(0, 0), block('a', 1024));
+  sender.put(1, 1024, 512, block('d', 512));
+  BOOST_CHECK_EQUAL(recipient.get(1, 1024), block('d', 512));
+}
+
+// Resumed senders store in new files and override previous blocks.
+ELLE_TEST_SCHEDULED(resume)
+{
+  Hermes hermes;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  auto sender = [&]
+    {
+      return elle::make_unique<HermesTransferBufferer>(
+        transaction, "127.0.0.1", hermes.port(), 1, 4096,
+        HermesTransferBufferer::Files{{"a", 4096}},
+        infinit::cryptography::Code());
+    };
+  sender()->put(0, 0, 1024, block('a', 1024));
+  {
+    auto resumed = sender();
+    resumed->put(0, 0, 1024, block('b', 1024));
+    resumed->put(0, 1024, 1024, block('c', 1024));
+  }
+  HermesTransferBufferer recipient(transaction, "127.0.0.1", hermes.port());
+  BOOST_CHECK_EQUAL(recipient.list().size(), 2);
+  BOOST_CHECK_EQUAL(recipient.get(0, 0), block('b', 1024));
+  BOOST_CHECK_EQUAL(recipient.get(0, 1024), block('c', 1024));
+}
+
+// Concurrent puts and gets share the pooled connections.
+ELLE_TEST_SCHEDULED(pipeline)
+{
+  Hermes hermes;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  int const blocks = 32;
+  HermesTransferBufferer sender(
+    transaction, "127.0.0.1", hermes.port(), 1, blocks * 1024,
+    {{"a", blocks * 1024}}, infinit::cryptography::Code(), 4);
+  HermesTransferBufferer recipient(
+    transaction, "127.0.0.1", hermes.port(), 4);
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    for (int i = 0; i < blocks; ++i)
+      scope.run_background(
+        elle::sprintf("put %s", i),
+        [&, i] { sender.put(0, i * 1024, 1024, block('a' + i, 1024)); });
+    scope.wait();
+    for (int i = 0; i < blocks; ++i)
+      scope.run_background(
+        elle::sprintf("get %s", i),
+        [&, i]
+        {
+          BOOST_CHECK_EQUAL(recipient.get(0, i * 1024), block('a' + i, 1024));
+        });
+    scope.wait();
+  };
+  BOOST_CHECK_LE(sender.connections(), 4);
+  BOOST_CHECK_LE(recipient.connections(), 4);
+  BOOST_CHECK_LE(hermes.connections_max, 8);
+}
+
+// The bufferer against the actual Hermes server, which answers fetches past
+// the stored bytes with an empty buffer where the in memory one throws.
+ELLE_TEST_SCHEDULED(actual_server)
+{
+  elle::filesystem::TemporaryDirectory root("hermes-bufferer");
+  oracle::hermes::Hermes hermes(
+    *reactor::Scheduler::scheduler(), 0, root.path().string());
+  reactor::Thread serve("hermes", [&] { hermes.run(); });
+  elle::SafeFinally stop([&] { serve.terminate_now(); });
+  while (hermes.port() == 0)
+    reactor::yield();
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = "transaction";
+  BOOST_CHECK_THROW(
+    HermesTransferBufferer(transaction, "127.0.0.1", hermes.port()),
+    TransferBufferer::DataExhausted);
+  auto sender = [&]
+    {
+      return elle::make_unique<HermesTransferBufferer>(
+        transaction, "127.0.0.1", hermes.port(), 2, 3072,
+        HermesTransferBufferer::Files{{"a", 2048}, {"b", 1024}},
+        infinit::cryptography::Code());
+    };
+  {
+    auto first = sender();
+    first->put(0, 0, 1024, block('a', 1024));
+    first->put(0, 1024, 1024, block('b', 1024));
+    first->put(1, 0, 1024, block('c', 1024));
+    BOOST_CHECK_EQUAL(first->get(0, 1024), block('b', 1024));
+    BOOST_CHECK_THROW(first->get(1, 1024), TransferBufferer::DataExhausted);
+  }
+  sender()->put(0, 0, 1024, block('d', 1024));
+  HermesTransferBufferer recipient(transaction, "127.0.0.1", hermes.port());
+  BOOST_CHECK_EQUAL(recipient.count(), 2);
+  BOOST_CHECK_EQUAL(recipient.full_size(), 3072);
+  BOOST_CHECK_EQUAL(recipient.list().size(), 3);
+  BOOST_CHECK_EQUAL(recipient.get(0, 0), block('d', 1024));
+  BOOST_CHECK_EQUAL(recipient.get(0, 1024), block('b', 1024));
+  BOOST_CHECK_EQUAL(recipient.get(1, 0), block('c', 1024));
+  recipient.cleanup();
+  BOOST_CHECK(!exists(root.path() / transaction.id));
+  BOOST_CHECK_THROW(
+    HermesTransferBufferer(transaction, "127.0.0.1", hermes.port()),
+    TransferBufferer::DataExhausted);
+}
+
+// Put and get HERMES_BENCH_SIZE MiB (8 by default) of 1 MiB blocks, four at
+// once like cloud uploads, through the server set in INFINIT_CLOUD_HERMES or
+// the in memory one. The figures compare with S3TransferBufferer runs on the
+// same blocks, which need AWS credentials.
+ELLE_TEST_SCHEDULED(bench)
+{
+  Hermes hermes;
+  auto server = HermesTransferBufferer::server();
+  std::string host = server ? server->first : "127.0.0.1";
+  int port = server ? server->second : hermes.port();
+  char const* env = ::getenv("HERMES_BENCH_SIZE");
+  int const blocks = env ? std::stoi(env) : 8;
+  int const size = 1024 * 1024;
+  infinit::oracles::PeerTransaction transaction;
+  transaction.id = elle::sprintf("bench-%s", std::time(nullptr));
+  HermesTransferBufferer sender(
+    transaction, host, port, 1, FileSize(blocks) * size,
+    {{"a", FileSize(blocks) * size}}, infinit::cryptography::Code());
+  HermesTransferBufferer recipient(transaction, host, port);
+  auto run = [&] (std::string const& name, std::function<void (int)> action)
+    {
+      auto start = boost::posix_time::microsec_clock::universal_time();
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        int next = 0;
+        for (int t = 0; t < 4; ++t)
+          scope.run_background(
+            elle::sprintf("%s %s", name, t),
+            [&]
+            {
+              for (int i = next++; i < blocks; i = next++)
+                action(i);
+            });
+        scope.wait();
+      };
+      auto elapsed =
+        boost::posix_time::microsec_clock::universal_time() - start;
+      std::cout << name << ": "
+                << blocks * 1000000. / elapsed.total_microseconds()
+                << " MiB/s" << std::endl;
+    };
+  auto const data = block('a', size);
+  run("put",
+      [&] (int i) { sender.put(0, FileSize(i) * size, size, data); });
+  run("get",
+      [&] (int i)
+      {
+        BOOST_CHECK_EQUAL(recipient.get(0, FileSize(i) * size).size(), size);
+      });
+}
+
+ELLE_TEST_SUITE()
+{
+  auto timeout = RUNNING_ON_VALGRIND ? 60 : 15;
+  auto& suite = boost::unit_test::framework::master_test_suite();
+  suite.add(BOOST_TEST_CASE(put_get_list), 0, timeout);
+  suite.add(BOOST_TEST_CASE(resume), 0, timeout);
+  suite.add(BOOST_TEST_CASE(pipeline), 0, timeout);
+  suite.add(BOOST_TEST_CASE(actual_server), 0, timeout);
+  suite.add(BOOST_TEST_CASE(bench), 0, timeout * 4);
+}
@@ -133,10 +133,98 @@ ELLE_TEST_SCHEDULED(other_402)
   BOOST_CHECK_EQUAL(beacon, true);
 }
 
+// Stand-in for the GCS resumable upload protocol, handing out GCS
+// credentials for links.
+class GCSServer
+  : public tests::Server
+{
+public:
+  GCSServer()
+    : uploaded(0)
+    , complete(false)
+  {
+    this->register_route(
+      "/gcs",
+      reactor::http::Method::PUT,
+      [this] (tests::Server::Headers const& headers,
+              tests::Server::Cookies const&,
+              tests::Server::Parameters const&,
+              elle::Buffer const& body)
+      {
+        auto it = headers.find("Content-Range");
+        BOOST_REQUIRE(it != headers.end());
+        std::string range = it->second;
+        ELLE_LOG("%s: GCS upload of %s", *this, range);
+        if (range == "bytes */*")
+        {
+          // Upload status.
+          if (!this->complete)
+            throw reactor::http::tests::Server::Exception(
+              "/gcs", reactor::http::StatusCode(308), "");
+          return std::string();
+        }
+        this->uploaded += body.size();
+        auto slash = range.find('/');
+        if (range.substr(slash + 1) != "*")
+          this->complete = true;
+        return std::string();
+      });
+  }
+
+  int64_t uploaded;
+  bool complete;
+
+protected:
+  std::string
+  _link_credentials(std::string const&) override
+  {
+    return elle::sprintf(
+      "{"
+      "  \"protocol\": \"gcs\","
+      "  \"url\": \"http://127.0.0.1:%s/gcs\","
+      "  \"expiration\": \"2016-01-12T09-37-42Z\","
+      "  \"current_time\": \"2015-01-12T09-37-42Z\""
+      "}",
+      this->port());
+  }
+};
+
+// Upload a link to GCS and check the upload throughput is recorded.
+ELLE_TEST_SCHEDULED(gcs_throughput)
+{
+  GCSServer server;
+  int const size = 1024 * 1024;
+  elle::filesystem::TemporaryFile transfered("gcs-uploaded");
+  {
+    boost::filesystem::ofstream f(transfered.path());
+    BOOST_CHECK(f.good());
+    for (int i = 0; i < size; ++i)
+    {
+      char c = i % 256;
+      f.write(&c, 1);
+    }
+  }
+  tests::Client sender(server, "sender@infinit.io");
+  sender.login();
+  BOOST_CHECK_EQUAL(sender.state->upload_throughput(), 0);
+  sender.state->create_link(
+    std::vector<std::string>{transfered.path().string().c_str()}, "message");
+  while (sender.state->upload_throughput() == 0)
+  {
+    reactor::sleep(100_ms);
+    sender.state->poll();
+  }
+  BOOST_CHECK(server.complete);
+  BOOST_CHECK_EQUAL(server.uploaded, size);
+  ELLE_LOG("GCS upload throughput: %s B/s",
+           sender.state->upload_throughput());
+}
+
 ELLE_TEST_SUITE()
 {
   auto timeout = valgrind(5);
   auto& suite = boost::unit_test::framework::master_test_suite();
   suite.add(BOOST_TEST_CASE(early_402), 0, timeout);
   suite.add(BOOST_TEST_CASE(other_402), 0, timeout);
+  suite.add(BOOST_TEST_CASE(gcs_throughput), 0, timeout);
 }
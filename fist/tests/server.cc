@@ -316,22 +316,10 @@ namespace tests
           auto res = elle::sprintf(
             "{"
             "  \"transaction\": %s,"
-            "  \"aws_credentials\": "
-            "  {"
-            "    \"protocol\": \"aws\","
-            "    \"access_key_id\": \"\","
-            "    \"bucket\": \"\","
-            "    \"expiration\": \"2016-01-12T09-37-42Z\","
-            "    \"folder\": \"%s\","
-            "    \"protocol\": \"aws\","
-            "    \"region\": \"us-east-1\","
-            "    \"secret_access_key\": \"\","
-            "    \"session_token\": \"\","
-            "    \"current_time\": \"2015-01-12T09-37-42Z\""
-            "  }"
+            "  \"aws_credentials\": %s"
             "}",
             User::link_representation(t),
-            id);
+            this->_link_credentials(id));
           return res;
         });
 
@@ -1119,6 +1107,25 @@ namespace tests
     this->_session_id = std::move(id);
   }
 
+  std::string
+  Server::_link_credentials(std::string const& id)
+  {
+    return elle::sprintf(
+      "{"
+      "  \"protocol\": \"aws\","
+      "  \"access_key_id\": \"\","
+      "  \"bucket\": \"\","
+      "  \"expiration\": \"2016-01-12T09-37-42Z\","
+      "  \"folder\": \"%s\","
+      "  \"protocol\": \"aws\","
+      "  \"region\": \"us-east-1\","
+      "  \"secret_access_key\": \"\","
+      "  \"session_token\": \"\","
+      "  \"current_time\": \"2015-01-12T09-37-42Z\""
+      "}",
+      id);
+  }
+
   void
   Server::_maybe_sleep()
   {
@@ -73,6 +73,11 @@ namespace tests
     void
     _maybe_sleep();
 
+    /// The cloud credentials JSON of link id.
+    virtual
+    std::string
+    _link_credentials(std::string const& id);
+
     virtual
     std::string
     _transaction_put(Headers const&,
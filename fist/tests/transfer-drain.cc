@@ -0,0 +1,196 @@
+#include <set>
+
+#include <boost/filesystem/fstream.hpp>
+
+#include <elle/filesystem/TemporaryDirectory.hh>
+#include <elle/filesystem/TemporaryFile.hh>
+#include <elle/log.hh>
+#include <elle/test.hh>
+
+#include <cryptography/KeyPair.hh>
+
+#include <frete/Frete.hh>
+
+#include <surface/gap/PeerReceiveMachine.hh>
+#include <surface/gap/State.hh>
+#include <surface/gap/TransferBufferer.hh>
+
+#include "server.hh"
+
+ELLE_LOG_COMPONENT("surface.gap.PeerReceiveMachine.test");
+
+using surface::gap::TransferBufferer;
+
+// A receive machine whose transfer operation can be drained from the test.
+class DrainedMachine
+  : public surface::gap::PeerReceiveMachine
+{
+public:
+  DrainedMachine(surface::gap::Transaction& transaction,
+                 uint32_t id,
+                 std::shared_ptr<Data> data)
+    : TransactionMachine(transaction, id, data)
+    , PeerReceiveMachine(transaction, id, data)
+  {}
+
+  using PeerReceiveMachine::_transfer_drain;
+};
+
+// Serve a frete, recording every block read and draining the machine after a
+// few of them, as when a direct connection shows up while relayed.
+class DrainingSource
+  : public TransferBufferer
+{
+public:
+  typedef std::pair<FileID, FileOffset> Block;
+
+  DrainingSource(infinit::oracles::PeerTransaction& transaction,
+                 frete::Frete& frete,
+                 DrainedMachine& machine,
+                 int drain_after)
+    : TransferBufferer(transaction)
+    , reads()
+    , _frete(frete)
+    , _machine(machine)
+    , _drain_after(drain_after)
+    , _key_code(frete.key_code())
+  {}
+
+  std::vector<Block> reads;
+
+  FileCount
+  count() const override
+  {
+    return this->_frete.count();
+  }
+
+  FileSize
+  full_size() const override
+  {
+    return this->_frete.full_size();
+  }
+
+  std::vector<std::pair<std::string, FileSize>>
+  files_info() const override
+  {
+    return this->_frete.files_info();
+  }
+
+  infinit::cryptography::Code
+  read(FileID f, FileOffset start, FileSize size) override
+  {
+    return this->_frete.read(f, start, size);
+  }
+
+  infinit::cryptography::Code
+  encrypted_read(FileID f, FileOffset start, FileSize size) override
+  {
+    this->reads.push_back(Block(f, start));
+    if (int(this->reads.size()) == this->_drain_after)
+      this->_machine._transfer_drain();
+    // Leave other readers time to have their requests in flight.
+    reactor::sleep(10_ms);
+    return this->_frete.encrypted_read(f, start, size);
+  }
+
+  infinit::cryptography::Code const&
+  key_code() const override
+  {
+    return this->_key_code;
+  }
+
+  void
+  put(FileID, FileOffset, FileSize, elle::ConstWeakBuffer const&) override
+  {
+    elle::unreachable();
+  }
+
+  elle::Buffer
+  get(FileID, FileOffset) override
+  {
+    elle::unreachable();
+  }
+
+  List
+  list() override
+  {
+    return List();
+  }
+
+  void
+  cleanup() override
+  {}
+
+private:
+  frete::Frete& _frete;
+  DrainedMachine& _machine;
+  int _drain_after;
+  infinit::cryptography::Code _key_code;
+};
+
+// A drained transfer writes every block in flight and resumes after them: no
+// block is fetched twice.
+ELLE_TEST_SCHEDULED(no_refetch)
+{
+  tests::Server server;
+  auto const email = "recipient@infinit.io";
+  auto const password = "secret";
+  auto& sender = server.register_user("sender@infinit.io", password);
+  auto& recipient = server.register_user(email, password);
+  auto t = std::make_shared<tests::Transaction>();
+  t->recipient_id = recipient.id().repr();
+  t->sender_id = sender.id().repr();
+  t->status = infinit::oracles::Transaction::Status::initialized;
+  server.transactions().insert(t);
+  tests::State state(server, elle::UUID::random());
+  state->login(email, password);
+  while (state->transactions().empty())
+  {
+    reactor::sleep(100_ms);
+    state->poll();
+  }
+  auto& transaction = *state->transactions().begin()->second;
+  auto data = std::dynamic_pointer_cast<infinit::oracles::PeerTransaction>(
+    transaction.data());
+  BOOST_REQUIRE(data);
+  elle::filesystem::TemporaryFile transfered("drained");
+  std::string content;
+  for (int i = 0; i < 8 * 1024 * 1024; ++i)
+    content.push_back(char(i % 251));
+  {
+    boost::filesystem::ofstream f(transfered.path(), std::ios_base::binary);
+    f << content;
+  }
+  elle::filesystem::TemporaryDirectory frete_dir("transfer-drain");
+  auto keys = infinit::cryptography::KeyPair::generate(
+    infinit::cryptography::Cryptosystem::rsa, 2048);
+  frete::Frete frete(
+    "password", keys, frete_dir.path() / "frete.snapshot", "", false);
+  frete.set_peer_key(state->identity().pair().K());
+  frete.add(transfered.path());
+  DrainedMachine machine(transaction, transaction.id(), data);
+  DrainingSource source(*data, frete, machine, 10);
+  ELLE_LOG("drained transfer")
+    machine.get(source);
+  BOOST_CHECK(!machine.completed());
+  auto drained = source.reads.size();
+  BOOST_CHECK_GE(drained, 10);
+  BOOST_CHECK_LT(drained * (1 << 18), content.size());
+  ELLE_LOG("resumed transfer")
+    machine.get(source);
+  BOOST_CHECK(machine.completed());
+  std::set<DrainingSource::Block> blocks(source.reads.begin(),
+                                         source.reads.end());
+  BOOST_CHECK_EQUAL(blocks.size(), source.reads.size());
+  boost::filesystem::ifstream output(
+    state.download_dir().path() / "drained", std::ios_base::binary);
+  BOOST_CHECK(std::string(std::istreambuf_iterator<char>(output),
+                          std::istreambuf_iterator<char>()) == content);
+}
+
+ELLE_TEST_SUITE()
+{
+  auto timeout = RUNNING_ON_VALGRIND ? 60 : 20;
+  auto& suite = boost::unit_test::framework::master_test_suite();
+  suite.add(BOOST_TEST_CASE(no_refetch), 0, timeout);
+}
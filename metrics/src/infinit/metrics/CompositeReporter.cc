@@ -106,13 +106,15 @@ namespace infinit
     void
     CompositeReporter::_transaction_connected(std::string const& transaction_id,
                            std::string const& connection_method,
-                           int attempt)
+                           int attempt,
+                           float duration)
     {
       this->_dispatch(std::bind(&Reporter::_transaction_connected,
                                 std::placeholders::_1,
                                 transaction_id,
                                 connection_method,
-                                attempt));
+                                attempt,
+                                duration));
     }
 
     void
@@ -134,13 +134,15 @@ namespace infinit
     void
     Reporter::transaction_connected(std::string const& transaction_id,
                                     std::string const& connection_method,
-                                    int attempt)
+                                    int attempt,
+                                    float duration)
     {
       this->_push(std::bind(&Reporter::_transaction_connected,
                                          this,
                                          transaction_id,
                                          connection_method,
-                                         attempt));
+                                         attempt,
+                                         duration));
     }
 
     void
@@ -468,7 +470,8 @@ namespace infinit
     void
     Reporter::_transaction_connected(std::string const& transaction_id,
                                      std::string const& connection_method,
-                                     int attempt)
+                                     int attempt,
+                                     float duration)
     {}
 
     void
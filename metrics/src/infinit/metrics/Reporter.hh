@@ -96,7 +96,8 @@ namespace infinit
       void
       transaction_connected(std::string const& transaction_id,
                             std::string const& connection_method,
-                            int attempt);
+                            int attempt,
+                            float duration);
 
       void
       link_transaction_created(std::string const& transaction_id,
@@ -170,7 +171,8 @@ namespace infinit
       void
       _transaction_connected(std::string const& transaction_id,
                              std::string const& connection_method,
-                             int attempt);
+                             int attempt,
+                             float duration);
 
       virtual
       void
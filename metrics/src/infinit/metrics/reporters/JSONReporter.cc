@@ -46,7 +46,8 @@ namespace infinit
     JSONReporter::_transaction_connected(
       std::string const& transaction_id,
       std::string const& connection_method,
-      int attempt)
+      int attempt,
+      float duration)
     {
       elle::json::Object data;
       data[this->_key_str(JSONKey::event)] =
@@ -54,6 +55,7 @@ namespace infinit
       data[this->_key_str(JSONKey::transaction_id)] = transaction_id;
       data[this->_key_str(JSONKey::connection_method)] = connection_method;
       data[this->_key_str(JSONKey::attempt_number)] = attempt;
+      data[this->_key_str(JSONKey::duration)] = duration;
 
       this->_send(this->_transaction_dest, data);
     }
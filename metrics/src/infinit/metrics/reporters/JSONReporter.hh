@@ -91,7 +91,8 @@ namespace infinit
       void
       _transaction_connected(std::string const& transaction_id,
                              std::string const& connection_method,
-                             int attempt) override;
+                             int attempt,
+                             float duration) override;
 
       void
       _link_transaction_created(std::string const& transaction_id,
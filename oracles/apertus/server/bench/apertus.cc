@@ -0,0 +1,275 @@
+// Load apertus with synthetic transactions over loopback and report pairing
+// latency, relay throughput, memory per relay and CPU per gigabyte.
+//
+// Clients run in the same process as the relay: memory and CPU figures
+// include both ends of every relayed transfer.
+
+#include <boost/program_options.hpp>
+
+#include <elle/Exception.hh>
+#include <elle/log.hh>
+
+#include <reactor/network/buffer.hh>
+#include <reactor/network/fingerprinted-socket.hh>
+#include <reactor/network/tcp-socket.hh>
+#include <reactor/scheduler.hh>
+#include <reactor/Scope.hh>
+
+#include <infinit/oracles/apertus/Apertus.hh>
+
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+
+#ifdef INFINIT_LINUX
+# include <unistd.h>
+#endif
+
+ELLE_LOG_COMPONENT("infinit.oracles.apertus.bench");
+
+static const std::vector<unsigned char> fingerprint =
+{
+  0x98, 0x55, 0xEF, 0x72, 0x1D, 0xFC, 0x1B, 0xF5, 0xEA, 0xF5,
+  0x35, 0xC5, 0xF9, 0x32, 0x85, 0x38, 0x38, 0x2C, 0xCA, 0x91
+};
+
+struct Options
+{
+  int pairs;
+  int concurrency;
+  std::size_t size;
+  std::size_t chunk;
+  std::string pattern;
+  bool ssl;
+};
+
+static
+Options
+parse_options(int argc, char** argv)
+{
+  using namespace boost::program_options;
+  options_description options("Allowed options");
+  options.add_options()
+    ("help,h", "display this help and exit")
+    ("pairs,n", value<int>()->default_value(1000),
+     "specify the number of transactions to relay")
+    ("concurrency,c", value<int>()->default_value(100),
+     "specify the number of transactions relayed at once")
+    ("size,s", value<std::size_t>()->default_value(1024 * 1024),
+     "specify the bytes relayed by each transaction")
+    ("chunk", value<std::size_t>()->default_value(64 * 1024),
+     "specify the size of client writes")
+    ("pattern,p", value<std::string>()->default_value("random"),
+     "specify the payload: zero, text or random")
+    ("ssl", "connect through SSL instead of plain TCP")
+    ;
+  variables_map vm;
+  try
+  {
+    store(parse_command_line(argc, argv, options), vm);
+    notify(vm);
+  }
+  catch (error const& e)
+  {
+    throw elle::Exception(elle::sprintf("command line error: %s", e.what()));
+  }
+  if (vm.count("help"))
+  {
+    std::cout << "Usage: " << argv[0] << " [options]" << std::endl;
+    std::cout << std::endl;
+    std::cout << options;
+    exit(0);
+  }
+  Options res;
+  res.pairs = vm["pairs"].as<int>();
+  res.concurrency = vm["concurrency"].as<int>();
+  res.size = vm["size"].as<std::size_t>();
+  res.chunk = vm["chunk"].as<std::size_t>();
+  res.pattern = vm["pattern"].as<std::string>();
+  res.ssl = vm.count("ssl");
+  if (res.pairs < 1 || res.concurrency < 1 || res.chunk == 0)
+    throw elle::Exception("pairs, concurrency and chunk must be positive");
+  return res;
+}
+
+static
+std::string
+payload(std::string const& pattern, std::size_t size)
+{
+  std::string res(size, '\0');
+  if (pattern == "zero")
+    ;
+  else if (pattern == "text")
+  {
+    static std::string const text =
+      "By the Power of Grayskull, I have the power! ";
+    for (std::size_t i = 0; i < size; ++i)
+      res[i] = text[i % text.size()];
+  }
+  else if (pattern == "random")
+    std::generate(res.begin(), res.end(), [] { return std::rand(); });
+  else
+    throw elle::Exception(elle::sprintf("unknown pattern: %s", pattern));
+  return res;
+}
+
+/// Resident memory of the process in bytes, 0 if unknown.
+static
+std::size_t
+rss()
+{
+#ifdef INFINIT_LINUX
+  std::ifstream statm("/proc/self/statm");
+  std::size_t size = 0;
+  std::size_t resident = 0;
+  if (statm >> size >> resident)
+    return resident * ::sysconf(_SC_PAGESIZE);
+#endif
+  return 0;
+}
+
+static
+double
+percentile(std::vector<double> const& sorted, double p)
+{
+  if (sorted.empty())
+    return 0;
+  auto index = static_cast<std::size_t>(sorted.size() * p);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static
+void
+bench(Options const& options)
+{
+  infinit::oracles::apertus::Apertus apertus(
+    "http", "", 0, "127.0.0.1", 0, 0);
+  auto port = boost::lexical_cast<std::string>(
+    options.ssl ? apertus.port_ssl() : apertus.port_tcp());
+  auto connect = [&] () -> std::unique_ptr<reactor::network::Socket>
+    {
+      if (options.ssl)
+        return std::unique_ptr<reactor::network::Socket>(
+          new reactor::network::FingerprintedSocket(
+            "127.0.0.1", port, fingerprint));
+      else
+        return std::unique_ptr<reactor::network::Socket>(
+          new reactor::network::TCPSocket("127.0.0.1", port));
+    };
+  std::string const data = payload(options.pattern, options.chunk);
+  std::vector<double> latencies;
+  std::size_t relayed = 0;
+  // Relay one transaction and record its pairing latency.
+  auto transaction = [&] (int i)
+    {
+      auto tid = elle::sprintf("bench-%s", i);
+      std::string header(2, '\0');
+      header[1] = tid.size();
+      header += tid;
+      auto first = connect();
+      first->write(elle::ConstWeakBuffer(header));
+      auto second = connect();
+      auto start = boost::posix_time::microsec_clock::universal_time();
+      second->write(elle::ConstWeakBuffer(header));
+      // Paired clients receive a sync bit.
+      char sync;
+      second->read(reactor::network::Buffer(&sync, 1));
+      auto latency = boost::posix_time::microsec_clock::universal_time() - start;
+      latencies.push_back(latency.total_microseconds() / 1000.);
+      first->read(reactor::network::Buffer(&sync, 1));
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+      {
+        scope.run_background("write", [&]
+        {
+          for (std::size_t sent = 0; sent < options.size;)
+          {
+            auto size = std::min(data.size(), options.size - sent);
+            first->write(elle::ConstWeakBuffer(data.data(), size));
+            sent += size;
+          }
+        });
+        std::unique_ptr<char[]> buffer(new char[options.chunk]);
+        std::size_t received = 0;
+        while (received < options.size)
+          received += second->read_some(
+            reactor::network::Buffer(buffer.get(), options.chunk));
+        scope.wait();
+        relayed += received;
+      };
+    };
+  std::size_t const rss_base = rss();
+  std::size_t rss_peak = rss_base;
+  std::size_t relays_peak = 0;
+  std::clock_t cpu = std::clock();
+  auto start = boost::posix_time::microsec_clock::universal_time();
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background("memory", [&]
+    {
+      while (true)
+      {
+        auto relays = apertus.workers().size();
+        auto memory = rss();
+        if (memory > rss_peak)
+        {
+          rss_peak = memory;
+          relays_peak = relays;
+        }
+        reactor::sleep(100_ms);
+      }
+    });
+    int next = 0;
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& clients)
+    {
+      for (int c = 0; c < options.concurrency; ++c)
+        clients.run_background(
+          elle::sprintf("client %s", c),
+          [&]
+          {
+            for (int i = next++; i < options.pairs; i = next++)
+              transaction(i);
+          });
+      clients.wait();
+    };
+    scope.terminate_now();
+  };
+  auto wall = boost::posix_time::microsec_clock::universal_time() - start;
+  double seconds = wall.total_microseconds() / 1000000.;
+  double cpu_seconds = double(std::clock() - cpu) / CLOCKS_PER_SEC;
+  double gigabytes = relayed / (1024. * 1024. * 1024.);
+  std::sort(latencies.begin(), latencies.end());
+  std::cout
+    << "transactions:    " << options.pairs
+    << " (" << options.concurrency << " at once, "
+    << (options.ssl ? "SSL" : "TCP") << ")" << std::endl
+    << "pairing p50:     " << percentile(latencies, 0.5) << " ms" << std::endl
+    << "pairing p99:     " << percentile(latencies, 0.99) << " ms" << std::endl
+    << "throughput:      " << relayed / seconds / (1024 * 1024)
+    << " MiB/s" << std::endl
+    << "CPU per GB:      " << (gigabytes > 0 ? cpu_seconds / gigabytes : 0)
+    << " s" << std::endl;
+  if (relays_peak > 0)
+    std::cout << "RSS per relay:   "
+              << (rss_peak - rss_base) / relays_peak / 1024
+              << " KiB (" << relays_peak << " relays)" << std::endl;
+  apertus.stop();
+}
+
+int
+main(int argc, char** argv)
+{
+  try
+  {
+    auto options = parse_options(argc, argv);
+    reactor::Scheduler sched;
+    reactor::Thread main(sched, "main", [&] { bench(options); });
+    sched.run();
+  }
+  catch (std::exception const& e)
+  {
+    std::cerr << "fatal error: " << e.what() << std::endl;
+    return 1;
+  }
+}
@@ -22,6 +22,8 @@ namespace infinit
                          reactor::Duration timeout)
         : _apertus(apertus)
         , _client(std::move(client))
+        , _accepted(boost::posix_time::microsec_clock::universal_time())
+        , _identified()
         , _accepter(reactor::Thread::make_tracked(
           *reactor::Scheduler::scheduler(),
           elle::sprintf("accept-%s", this),
@@ -56,40 +58,13 @@ namespace infinit
         auto self = this->_apertus._take_from_accepters(this);
         try
         {
-          // Retrieve version
-          unsigned char version;
-          ELLE_TRACE("%s: read version", *this)
+          Apertus::TID tid;
           {
-            reactor::network::Buffer tmp(&version, 1);
-            this->_client->read(tmp);
-            ELLE_TRACE("%s: version: %i", *this, version);
+            this->_apertus._handshake_begin(this->_accepted);
+            elle::SafeFinally end([this] { this->_apertus._handshake_end(); });
+            tid = this->_read_tid();
           }
-          this->_sync_bit = version == 0;
-
-          // Retrieve TID size.
-          unsigned char size;
-          if (version != 0)
-          {
-            ELLE_TRACE("%s: old client, version is the TID size", *this);
-            size = version;
-          }
-          else
-          {
-            ELLE_TRACE_SCOPE("%s: read TID size", *this);
-            reactor::network::Buffer tmp(&size, 1);
-            this->_client->read(tmp);
-            ELLE_DEBUG("%s: TID size: %i", *this, size);
-          }
-
-          // Retrieve TID of the client.
-          char tid_array[size + 1];
-          tid_array[size] = '\0';
-          reactor::network::Buffer tid_buffer(tid_array, size);
-
-          ELLE_TRACE("%s: reading for the identifier", *this)
-            this->_client->read(tid_buffer);
-          Apertus::TID tid = std::string(tid_array);
-          ELLE_DEBUG("%s: identifier: %s", *this, tid);
+          this->_identified = boost::posix_time::microsec_clock::universal_time();
 
           // First client to connect with this TID, it must wait.
           auto peer_iterator = this->_apertus._clients.find(tid);
@@ -106,6 +81,8 @@ namespace infinit
             // clients.
             auto peer_acceptor = std::move(peer_iterator->second);
             this->_apertus._clients.erase(peer_iterator);
+            this->_apertus._pairing_waits.add(
+              this->_identified - peer_acceptor->_identified);
             auto peer_socket = std::move(peer_acceptor->_client);
             if (this->_sync_bit)
               ELLE_DEBUG("%s: send sync bit to %s", *this, *this->_client)
@@ -139,6 +116,46 @@ namespace infinit
         }
       }
 
+      Apertus::TID
+      Accepter::_read_tid()
+      {
+        // Retrieve version
+        unsigned char version;
+        ELLE_TRACE("%s: read version", *this)
+        {
+          reactor::network::Buffer tmp(&version, 1);
+          this->_client->read(tmp);
+          ELLE_TRACE("%s: version: %i", *this, version);
+        }
+        this->_sync_bit = version == 0;
+
+        // Retrieve TID size.
+        unsigned char size;
+        if (version != 0)
+        {
+          ELLE_TRACE("%s: old client, version is the TID size", *this);
+          size = version;
+        }
+        else
+        {
+          ELLE_TRACE_SCOPE("%s: read TID size", *this);
+          reactor::network::Buffer tmp(&size, 1);
+          this->_client->read(tmp);
+          ELLE_DEBUG("%s: TID size: %i", *this, size);
+        }
+
+        // Retrieve TID of the client.
+        char tid_array[size + 1];
+        tid_array[size] = '\0';
+        reactor::network::Buffer tid_buffer(tid_array, size);
+
+        ELLE_TRACE("%s: reading for the identifier", *this)
+          this->_client->read(tid_buffer);
+        Apertus::TID tid = std::string(tid_array);
+        ELLE_DEBUG("%s: identifier: %s", *this, tid);
+        return tid;
+      }
+
       /*----------.
       | Printable |
       `----------*/
@@ -10,6 +10,8 @@
 # include <elle/attribute.hh>
 # include <elle/Printable.hh>
 
+# include <boost/date_time/posix_time/posix_time.hpp>
+
 # include <memory>
 namespace infinit
 {
@@ -31,9 +33,15 @@ namespace infinit
         ~Accepter();
         void
         _handle();
+        /// Read the client version and transaction identifier.
+        std::string
+        _read_tid();
 
         ELLE_ATTRIBUTE(Apertus&, apertus);
         ELLE_ATTRIBUTE(Socket, client);
+        ELLE_ATTRIBUTE(boost::posix_time::ptime, accepted);
+        /// When the transaction identifier was received.
+        ELLE_ATTRIBUTE(boost::posix_time::ptime, identified);
         ELLE_ATTRIBUTE(reactor::ThreadPtr, accepter);
         ELLE_ATTRIBUTE(reactor::Timer, timeout);
         ELLE_ATTRIBUTE(bool, sync_bit);
@@ -6,16 +6,23 @@
 #include <reactor/exception.hh>
 #include <reactor/http/exceptions.hh>
 #include <reactor/network/exception.hh>
+#include <reactor/network/ssl-socket.hh>
+#include <reactor/Scope.hh>
 
 #include <elle/Error.hh>
 #include <elle/Exception.hh>
+#include <elle/finally.hh>
+#include <elle/json/json.hh>
 #include <elle/HttpClient.hh> // XXX: Remove that. Only for exception.
 #include <elle/log.hh>
 #include <elle/network/Interface.hh>
 #include <elle/network/hostname.hh>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <openssl/ssl.h>
+
 #include <algorithm>
 #include <tuple>
 #include <utility>
@@ -24,17 +31,32 @@ extern const std::vector<char> server_certificate;
 extern const std::vector<char> server_key;
 extern const std::vector<char> server_dh1024;
 
+// Seeded from the system entropy: shards started within the same second must
+// still register under distinct identifiers.
 static
 boost::uuids::uuid
 generate_uuid()
 {
-  boost::mt19937 rng;
-  rng.seed(std::time(0));
-  boost::uuids::basic_random_generator<boost::mt19937> gen(&rng);
+  boost::uuids::random_generator gen;
   return gen();
 }
 
 ELLE_LOG_COMPONENT("infinit.oracles.apertus.Apertus");
+
+/// Let reconnecting clients resume their TLS session, with a session id or a
+/// ticket, instead of going through a full handshake.
+static
+void
+enable_session_resumption(reactor::network::SSLCertificate& certificate)
+{
+  static unsigned char const context[] = "apertus";
+  auto ssl = certificate.context().native_handle();
+  SSL_CTX_set_session_id_context(ssl, context, sizeof(context) - 1);
+  SSL_CTX_set_session_cache_mode(ssl, SSL_SESS_CACHE_SERVER);
+  SSL_CTX_sess_set_cache_size(ssl, 16 * 1024);
+  SSL_CTX_set_timeout(ssl, 60 * 60);
+  SSL_CTX_clear_options(ssl, SSL_OP_NO_TICKET);
+}
 namespace infinit
 {
   namespace oracles
@@ -46,7 +68,10 @@ namespace infinit
                        int meta_port,
                        std::string const& host, int port_ssl, int port_tcp,
                        boost::posix_time::time_duration const& tick_rate,
-                       boost::posix_time::time_duration const& timeout)
+                       boost::posix_time::time_duration const& timeout,
+                       std::size_t buffer_budget,
+                       uint64_t rate_limit,
+                       uint64_t transfer_rate_limit)
         : Waitable("apertus")
         , _unregistered(false)
         , _accepter_ssl(nullptr)
@@ -60,18 +85,34 @@ namespace infinit
         , _certificate(nullptr)
         , _server_ssl(nullptr)
         , _server_tcp(nullptr)
+        , _handshake_max(128)
+        , _handshakes(0)
+        , _handshakes_queued(0)
+        , _handshakes_changed()
+        , _handshake_waits()
+        , _pairing_waits()
         , _bandwidth(0)
+        , _transferred(0)
+        , _started(boost::posix_time::microsec_clock::universal_time())
+        , _tick_stats()
         , _tick_rate(tick_rate)
         , _timeout(timeout)
+        , _buffers(buffer_budget)
+        , _rate_limiter(rate_limit)
+        , _transfer_rate_limit(transfer_rate_limit)
         , _monitor(*reactor::Scheduler::scheduler(),
                    "apertus_monitor",
                    std::bind(&Apertus::_run_monitor, std::ref(*this)))
+        , _port_stats(0)
+        , _server_stats(nullptr)
+        , _stats_server(nullptr)
       {
         try
         {
           this->_certificate.reset(new reactor::network::SSLCertificate(
                                      server_certificate, server_key, server_dh1024));
           ELLE_DEBUG("%s: loaded SSL certificate", *this);
+          enable_session_resumption(*this->_certificate);
 
           this->_server_ssl.reset(new reactor::network::SSLServer(
                                     std::move(this->_certificate)));
@@ -111,6 +152,8 @@ namespace infinit
 
       Apertus::~Apertus()
       {
+        if (this->_stats_server)
+          this->_stats_server->terminate_now();
         this->_monitor.terminate_now();
         if (this->_accepter_ssl)
           this->_accepter_ssl->terminate_now();
@@ -169,6 +212,14 @@ namespace infinit
         {
           while (true)
           {
+            // Leave clients in the listen backlog rather than piling up
+            // accepted ones that can't be served.
+            while (this->_handshakes_queued >= this->_handshake_max)
+            {
+              ELLE_DEBUG("%s: %s clients waiting for a handshake, wait",
+                         *this, this->_handshakes_queued);
+              reactor::wait(this->_handshakes_changed);
+            }
             ELLE_TRACE("%s: waiting for new client", *this);
             auto client = server.accept();
             ELLE_DEBUG("%s: socket opened", *this);
@@ -238,6 +289,52 @@ namespace infinit
           });
       }
 
+      /*-----------.
+      | Handshakes |
+      `-----------*/
+
+      void
+      Apertus::_handshake_begin(boost::posix_time::ptime const& accepted)
+      {
+        {
+          ++this->_handshakes_queued;
+          elle::SafeFinally dequeue(
+            [this]
+            {
+              --this->_handshakes_queued;
+              this->_handshakes_changed.signal();
+            });
+          while (this->_handshakes >= this->_handshake_max)
+            reactor::wait(this->_handshakes_changed);
+        }
+        ++this->_handshakes;
+        auto wait =
+          boost::posix_time::microsec_clock::universal_time() - accepted;
+        ELLE_DUMP("%s: handshake slot taken after %s", *this, wait);
+        this->_handshake_waits.add(wait);
+      }
+
+      void
+      Apertus::_handshake_end()
+      {
+        --this->_handshakes;
+        this->_handshakes_changed.signal();
+      }
+
+      Apertus::Waits::Waits()
+        : total()
+        , max()
+        , count(0)
+      {}
+
+      void
+      Apertus::Waits::add(boost::posix_time::time_duration const& wait)
+      {
+        this->total += wait;
+        this->max = std::max(this->max, wait);
+        ++this->count;
+      }
+
       /*----------.
       | Printable |
       `----------*/
@@ -251,9 +348,94 @@ namespace infinit
       | Monitoring |
       `-----------*/
       void
-      Apertus::add_to_bandwidth(uint32_t data)
+      Apertus::add_to_bandwidth(uint64_t data)
       {
-        _bandwidth += data;
+        this->_bandwidth += data;
+        this->_transferred += data;
+      }
+
+      static
+      double
+      milliseconds(boost::posix_time::time_duration const& duration)
+      {
+        return duration.total_microseconds() / 1000.;
+      }
+
+      elle::json::Object
+      Apertus::stats() const
+      {
+        auto now = boost::posix_time::microsec_clock::universal_time();
+        elle::json::Object res = this->_tick_stats;
+        res["uuid"] = boost::lexical_cast<std::string>(this->_uuid);
+        res["uptime"] = milliseconds(now - this->_started) / 1000;
+        res["transferred"] = int64_t(this->_transferred);
+        res["accepters"] = int64_t(this->_accepters.size() +
+                                   this->_handshakes +
+                                   this->_handshakes_queued);
+        res["handshakes"] = int64_t(this->_handshakes);
+        res["handshakes_queued"] = int64_t(this->_handshakes_queued);
+        res["unpaired"] = int64_t(this->_clients.size());
+        res["memory"] = int64_t(this->_buffers.used());
+        std::vector<boost::any> transfers;
+        for (auto const& worker: this->_workers)
+        {
+          auto const& transfer = *worker.second;
+          elle::json::Object o;
+          o["tid"] = transfer.tid();
+          o["transferred"] = int64_t(transfer.transferred());
+          o["rate"] = int64_t(transfer.rate());
+          o["memory"] = int64_t(transfer.memory());
+          o["age"] = milliseconds(now - transfer.started()) / 1000;
+          transfers.push_back(std::move(o));
+        }
+        res["transfers"] = std::move(transfers);
+        return res;
+      }
+
+      void
+      Apertus::serve_stats(int port)
+      {
+        this->_server_stats.reset(new reactor::network::TCPServer());
+        this->_server_stats->listen(
+          boost::asio::ip::tcp::endpoint(
+            boost::asio::ip::address_v4::loopback(), port));
+        this->_port_stats = this->_server_stats->port();
+        ELLE_LOG("%s: serve stats on 127.0.0.1:%s", *this, this->_port_stats);
+        this->_stats_server.reset(
+          new reactor::Thread(*reactor::Scheduler::scheduler(),
+                              "apertus_stats",
+                              [this] { this->_serve_stats(); }));
+      }
+
+      void
+      Apertus::_serve_stats()
+      {
+        elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+        {
+          while (true)
+          {
+            std::shared_ptr<reactor::network::Socket> client(
+              this->_server_stats->accept());
+            ELLE_DEBUG("%s: send stats to %s", *this, *client);
+            // Take the snapshot right away, writing may take a while.
+            auto stats = this->stats();
+            scope.run_background(
+              elle::sprintf("%s: stats", *this),
+              [client, stats]
+              {
+                try
+                {
+                  elle::json::write(*client, stats);
+                  client->flush();
+                }
+                catch (reactor::network::Exception const&)
+                {
+                  ELLE_TRACE("unable to send stats: %s",
+                             elle::exception_string());
+                }
+              });
+          }
+        };
       }
 
       void
@@ -263,9 +445,36 @@ namespace infinit
         {
           reactor::sleep(_tick_rate);
 
-          uint32_t bdwps = _bandwidth / _tick_rate.total_seconds();
+          uint64_t bdwps = _bandwidth / _tick_rate.total_seconds();
           ELLE_TRACE("%s: bandwidth is currently estimated at %sB/s",
             *this, bdwps);
+          ELLE_TRACE("%s: relay memory: %s", *this, this->_buffers);
+          elle::json::Object tick;
+          tick["bandwidth"] = int64_t(bdwps);
+          auto report = [&] (std::string const& name, Waits& waits)
+            {
+              if (waits.count > 0)
+                ELLE_TRACE("%s: %s %s waited %s on average, %s at most",
+                           *this, waits.count, name,
+                           waits.total / waits.count, waits.max);
+              elle::json::Object o;
+              o["count"] = int64_t(waits.count);
+              o["average"] =
+                waits.count > 0 ? milliseconds(waits.total) / waits.count : 0.;
+              o["max"] = milliseconds(waits.max);
+              tick[name] = std::move(o);
+              waits = Waits();
+            };
+          report("handshake_waits", this->_handshake_waits);
+          report("pairing_waits", this->_pairing_waits);
+          this->_tick_stats = std::move(tick);
+          for (auto const& worker: this->_workers)
+          {
+            worker.second->_rate_update(this->_tick_rate);
+            ELLE_DEBUG("%s: %s relays %sB/s and uses %s bytes",
+                       *this, *worker.second, worker.second->rate(),
+                       worker.second->memory());
+          }
 
           if (this->_meta_enabled)
             try
@@ -3,6 +3,8 @@
 
 # include <infinit/oracles/apertus/fwd.hh>
 # include <infinit/oracles/apertus/Accepter.hh>
+# include <infinit/oracles/apertus/BufferPool.hh>
+# include <infinit/oracles/apertus/RateLimiter.hh>
 # include <infinit/oracles/meta/Admin.hh>
 
 # include <reactor/network/buffer.hh>
@@ -10,9 +12,11 @@
 # include <reactor/network/ssl-server.hh>
 # include <reactor/network/tcp-server.hh>
 # include <reactor/operation.hh>
+# include <reactor/signal.hh>
 # include <reactor/waitable.hh>
 
 # include <elle/Printable.hh>
+# include <elle/json/json.hh>
 
 # include <boost/date_time/posix_time/posix_time.hpp>
 # include <boost/uuid/random_generator.hpp>
@@ -43,7 +47,10 @@ namespace infinit
                 int port_ssl = 6566,
                 int port_tcp = 6565,
                 boost::posix_time::time_duration const& tick_rate = 10_sec,
-                boost::posix_time::time_duration const& timeout = 5_min
+                boost::posix_time::time_duration const& timeout = 5_min,
+                std::size_t buffer_budget = 1024 * 1024 * 1024,
+                uint64_t rate_limit = 0,
+                uint64_t transfer_rate_limit = 0
                 );
         ~Apertus();
 
@@ -112,6 +119,38 @@ namespace infinit
         // id received, not associated
         ELLE_ATTRIBUTE_R(Clients, clients);
 
+        /*-----------.
+        | Handshakes |
+        `-----------*/
+      private:
+        /// Wait for a handshake slot for a client accepted at the given time.
+        void
+        _handshake_begin(boost::posix_time::ptime const& accepted);
+        void
+        _handshake_end();
+        /// The maximum number of concurrent client handshakes.
+        ELLE_ATTRIBUTE_RW(int, handshake_max);
+        /// The number of client handshakes in progress.
+        ELLE_ATTRIBUTE_R(int, handshakes);
+        /// The number of accepted clients waiting for a handshake slot.
+        ELLE_ATTRIBUTE_R(int, handshakes_queued);
+        /// Signals when a handshake slot is taken or released.
+        ELLE_ATTRIBUTE(reactor::Signal, handshakes_changed);
+        /// Wait durations accumulated over a monitoring tick.
+        struct Waits
+        {
+          Waits();
+          void
+          add(boost::posix_time::time_duration const& wait);
+          boost::posix_time::time_duration total;
+          boost::posix_time::time_duration max;
+          int count;
+        };
+        /// Time clients waited for a handshake slot.
+        ELLE_ATTRIBUTE(Waits, handshake_waits);
+        /// Time identified clients waited for their peer.
+        ELLE_ATTRIBUTE(Waits, pairing_waits);
+
         /*----------.
         | Printable |
         `----------*/
@@ -124,17 +163,41 @@ namespace infinit
         `-----------*/
       public:
         void
-        add_to_bandwidth(uint32_t data);
+        add_to_bandwidth(uint64_t data);
+        /// Live state of the relay and statistics of the last tick.
+        elle::json::Object
+        stats() const;
+        /// Serve stats as JSON to local connections on the given port.
+        void
+        serve_stats(int port = 0);
 
       private:
         void
         _run_monitor();
+        void
+        _serve_stats();
 
       private:
-        ELLE_ATTRIBUTE(uint32_t, bandwidth);
+        /// Bytes relayed since the last tick.
+        ELLE_ATTRIBUTE(uint64_t, bandwidth);
+        /// Bytes relayed since startup.
+        ELLE_ATTRIBUTE_R(uint64_t, transferred);
+        ELLE_ATTRIBUTE(boost::posix_time::ptime, started);
+        /// Statistics computed on the last tick.
+        ELLE_ATTRIBUTE(elle::json::Object, tick_stats);
         ELLE_ATTRIBUTE(boost::posix_time::time_duration, tick_rate);
         ELLE_ATTRIBUTE(boost::posix_time::time_duration, timeout);
+        /// The relay buffers of all transfers.
+        ELLE_ATTRIBUTE_RX(BufferPool, buffers);
+        /// Bandwidth shared fairly by all transfers.
+        ELLE_ATTRIBUTE(RateLimiter, rate_limiter);
+        /// Bytes per second allowed to each transfer, 0 for no limit.
+        ELLE_ATTRIBUTE_R(uint64_t, transfer_rate_limit);
         ELLE_ATTRIBUTE(reactor::Thread, monitor);
+        ELLE_ATTRIBUTE_R(int, port_stats);
+        ELLE_ATTRIBUTE(std::unique_ptr<reactor::network::TCPServer>,
+                       server_stats);
+        ELLE_ATTRIBUTE(std::unique_ptr<reactor::Thread>, stats_server);
       };
     }
   }
@@ -0,0 +1,172 @@
+#include <infinit/oracles/apertus/BufferPool.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <elle/assert.hh>
+#include <elle/log.hh>
+
+ELLE_LOG_COMPONENT("infinit.oracles.apertus.BufferPool");
+
+namespace infinit
+{
+  namespace oracles
+  {
+    namespace apertus
+    {
+      /*-------------.
+      | Construction |
+      `-------------*/
+
+      BufferPool::BufferPool(std::size_t budget)
+        : _free()
+        , _released()
+        , _budget(budget)
+        , _allocated(0)
+        , _used(0)
+      {}
+
+      /*--------.
+      | Buffers |
+      `--------*/
+
+      BufferPool::Buffer::Buffer(BufferPool& pool,
+                                 std::unique_ptr<char[]> data,
+                                 std::size_t size)
+        : _pool(&pool)
+        , _data(std::move(data))
+        , _size(size)
+      {}
+
+      BufferPool::Buffer::Buffer(Buffer&& source)
+        : _pool(source._pool)
+        , _data(std::move(source._data))
+        , _size(source._size)
+      {
+        source._pool = nullptr;
+      }
+
+      BufferPool::Buffer::~Buffer()
+      {
+        if (this->_pool && this->_data)
+          this->_pool->_release(std::move(this->_data), this->_size);
+      }
+
+      BufferPool::Buffer&
+      BufferPool::Buffer::operator =(Buffer&& source)
+      {
+        if (this->_pool && this->_data)
+          this->_pool->_release(std::move(this->_data), this->_size);
+        this->_pool = source._pool;
+        this->_data = std::move(source._data);
+        this->_size = source._size;
+        source._pool = nullptr;
+        return *this;
+      }
+
+      char*
+      BufferPool::Buffer::data()
+      {
+        return this->_data.get();
+      }
+
+      BufferPool::Buffer
+      BufferPool::acquire(std::size_t size)
+      {
+        ELLE_ASSERT_LTE(size, this->_budget);
+        while (true)
+        {
+          if (auto res = this->try_acquire(size))
+            return std::move(*res);
+          ELLE_DEBUG("%s: budget exhausted, wait for %s bytes", *this, size);
+          reactor::wait(this->_released);
+        }
+      }
+
+      std::vector<BufferPool::Buffer>
+      BufferPool::acquire(std::size_t size, int count)
+      {
+        ELLE_ASSERT_LTE(size * count, this->_budget);
+        while (true)
+        {
+          std::vector<Buffer> res;
+          res.reserve(count);
+          while (static_cast<int>(res.size()) < count)
+          {
+            auto buffer = this->try_acquire(size);
+            if (!buffer)
+              break;
+            res.push_back(std::move(*buffer));
+          }
+          if (static_cast<int>(res.size()) == count)
+            return res;
+          ELLE_DEBUG("%s: budget exhausted, wait for %s buffers of %s bytes",
+                     *this, count, size);
+          // Give back what we got before waiting.
+          res.clear();
+          reactor::wait(this->_released);
+        }
+      }
+
+      std::unique_ptr<BufferPool::Buffer>
+      BufferPool::try_acquire(std::size_t size)
+      {
+        std::unique_ptr<char[]> data;
+        auto& free = this->_free[size];
+        if (!free.empty())
+        {
+          data = std::move(free.back());
+          free.pop_back();
+        }
+        else
+        {
+          if (!this->_reclaim(size))
+            return nullptr;
+          // Relayed data is always read before being written: don't bother
+          // zeroing it.
+          data.reset(new char[size]);
+          this->_allocated += size;
+        }
+        this->_used += size;
+        ELLE_DUMP("%s: lend %s bytes", *this, size);
+        return std::unique_ptr<Buffer>(new Buffer(*this, std::move(data), size));
+      }
+
+      void
+      BufferPool::_release(std::unique_ptr<char[]> data, std::size_t size)
+      {
+        ELLE_DUMP("%s: get back %s bytes", *this, size);
+        ELLE_ASSERT_GTE(this->_used, size);
+        this->_used -= size;
+        this->_free[size].push_back(std::move(data));
+        this->_released.signal();
+      }
+
+      bool
+      BufferPool::_reclaim(std::size_t size)
+      {
+        auto it = this->_free.begin();
+        while (this->_allocated + size > this->_budget)
+        {
+          while (it != this->_free.end() && it->second.empty())
+            ++it;
+          if (it == this->_free.end())
+            return false;
+          it->second.pop_back();
+          this->_allocated -= it->first;
+        }
+        return true;
+      }
+
+      /*----------.
+      | Printable |
+      `----------*/
+
+      void
+      BufferPool::print(std::ostream& stream) const
+      {
+        elle::fprintf(stream, "BufferPool(%s/%s bytes, %s allocated)",
+                      this->_used, this->_budget, this->_allocated);
+      }
+    }
+  }
+}
@@ -0,0 +1,108 @@
+#ifndef INFINIT_ORACLES_APERTUS_BUFFER_POOL_HH
+# define INFINIT_ORACLES_APERTUS_BUFFER_POOL_HH
+
+# include <reactor/signal.hh>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <cstddef>
+# include <memory>
+# include <unordered_map>
+# include <vector>
+
+namespace infinit
+{
+  namespace oracles
+  {
+    namespace apertus
+    {
+      /// Relay buffers shared by all transfers, within a memory budget.
+      ///
+      /// Released buffers are kept for reuse and freed when the budget is
+      /// needed for buffers of another size.
+      class BufferPool:
+        public elle::Printable
+      {
+      /*-------------.
+      | Construction |
+      `-------------*/
+      public:
+        /// \param budget The maximum number of bytes allocated at once.
+        BufferPool(std::size_t budget);
+        BufferPool(BufferPool const&) = delete;
+
+      /*--------.
+      | Buffers |
+      `--------*/
+      public:
+        /// A buffer borrowed from the pool, given back on destruction.
+        class Buffer
+        {
+        public:
+          Buffer(Buffer&& source);
+          ~Buffer();
+          Buffer(Buffer const&) = delete;
+          Buffer&
+          operator =(Buffer&& source);
+
+          char*
+          data();
+
+        private:
+          friend class BufferPool;
+          Buffer(BufferPool& pool,
+                 std::unique_ptr<char[]> data,
+                 std::size_t size);
+          ELLE_ATTRIBUTE(BufferPool*, pool);
+          ELLE_ATTRIBUTE(std::unique_ptr<char[]>, data);
+          ELLE_ATTRIBUTE_R(std::size_t, size);
+        };
+
+        /// Borrow a buffer, waiting for the budget to allow it.
+        Buffer
+        acquire(std::size_t size);
+        /// Borrow count buffers, waiting for the budget to allow all of them.
+        /// None is held while waiting, so that users needing several buffers
+        /// don't sit on memory they can't use yet.
+        std::vector<Buffer>
+        acquire(std::size_t size, int count);
+        /// Borrow a buffer if the budget allows it right away.
+        std::unique_ptr<Buffer>
+        try_acquire(std::size_t size);
+
+      private:
+        void
+        _release(std::unique_ptr<char[]> data, std::size_t size);
+        /// Free cached buffers until size bytes fit in the budget.
+        bool
+        _reclaim(std::size_t size);
+        typedef std::vector<std::unique_ptr<char[]>> Free;
+        typedef std::unordered_map<std::size_t, Free> FreeLists;
+        /// Cached buffers by size.
+        ELLE_ATTRIBUTE(FreeLists, free);
+        /// Signaled when memory is given back to the pool.
+        ELLE_ATTRIBUTE(reactor::Signal, released);
+
+      /*-----------.
+      | Accounting |
+      `-----------*/
+      public:
+        ELLE_ATTRIBUTE_R(std::size_t, budget);
+        /// Bytes allocated, borrowed or cached.
+        ELLE_ATTRIBUTE_R(std::size_t, allocated);
+        /// Bytes borrowed.
+        ELLE_ATTRIBUTE_R(std::size_t, used);
+
+      /*----------.
+      | Printable |
+      `----------*/
+      public:
+        void
+        print(std::ostream& stream) const override;
+      };
+    }
+  }
+}
+
+#endif
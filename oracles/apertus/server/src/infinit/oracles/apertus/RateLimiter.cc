@@ -0,0 +1,105 @@
+#include <infinit/oracles/apertus/RateLimiter.hh>
+
+#include <reactor/scheduler.hh>
+
+#include <elle/finally.hh>
+#include <elle/log.hh>
+
+#include <algorithm>
+
+ELLE_LOG_COMPONENT("infinit.oracles.apertus.RateLimiter");
+
+namespace infinit
+{
+  namespace oracles
+  {
+    namespace apertus
+    {
+      /*-------------.
+      | Construction |
+      `-------------*/
+
+      RateLimiter::RateLimiter(uint64_t rate, std::size_t burst)
+        : _rate(rate)
+        , _burst(std::max(burst, quantum))
+        , _tokens(this->_burst)
+        , _refilled(boost::posix_time::microsec_clock::universal_time())
+        , _queue()
+      {}
+
+      /*------------.
+      | Consumption |
+      `------------*/
+
+      std::size_t const RateLimiter::quantum = 64 * 1024;
+
+      void
+      RateLimiter::consume(std::size_t size)
+      {
+        if (this->_rate == 0)
+          return;
+        while (size > 0)
+        {
+          auto slice = std::min(size, quantum);
+          this->_consume(slice);
+          size -= slice;
+        }
+      }
+
+      void
+      RateLimiter::_consume(std::size_t size)
+      {
+        reactor::Barrier turn;
+        this->_queue.push_back(&turn);
+        auto self = std::prev(this->_queue.end());
+        elle::SafeFinally leave(
+          [&]
+          {
+            bool first = self == this->_queue.begin();
+            this->_queue.erase(self);
+            if (first && !this->_queue.empty())
+              this->_queue.front()->open();
+          });
+        if (self != this->_queue.begin())
+        {
+          ELLE_DUMP("%s: wait for %s other consumers",
+                    *this, this->_queue.size() - 1);
+          reactor::wait(turn);
+        }
+        this->_refill();
+        if (this->_tokens < size)
+        {
+          auto missing = (size - this->_tokens) / this->_rate;
+          auto delay = boost::posix_time::microseconds(
+            static_cast<int64_t>(missing * 1000000) + 1);
+          ELLE_DEBUG("%s: throttle %s bytes for %s", *this, size, delay);
+          reactor::sleep(delay);
+          this->_refill();
+        }
+        this->_tokens -= size;
+      }
+
+      void
+      RateLimiter::_refill()
+      {
+        auto now = boost::posix_time::microsec_clock::universal_time();
+        auto elapsed = (now - this->_refilled).total_microseconds();
+        this->_refilled = now;
+        this->_tokens = std::min(
+          double(this->_burst),
+          this->_tokens + double(this->_rate) * elapsed / 1000000);
+      }
+
+      /*----------.
+      | Printable |
+      `----------*/
+
+      void
+      RateLimiter::print(std::ostream& stream) const
+      {
+        elle::fprintf(stream, "RateLimiter(%s B/s, %s queued)",
+                      this->_rate, this->_queue.size());
+      }
+    }
+  }
+}
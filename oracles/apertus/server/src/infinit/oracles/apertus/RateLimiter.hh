@@ -0,0 +1,70 @@
+#ifndef INFINIT_ORACLES_APERTUS_RATE_LIMITER_HH
+# define INFINIT_ORACLES_APERTUS_RATE_LIMITER_HH
+
+# include <reactor/Barrier.hh>
+
+# include <elle/Printable.hh>
+# include <elle/attribute.hh>
+
+# include <boost/date_time/posix_time/posix_time.hpp>
+
+# include <cstddef>
+# include <cstdint>
+# include <list>
+
+namespace infinit
+{
+  namespace oracles
+  {
+    namespace apertus
+    {
+      /// Token bucket shared by relay coroutines.
+      ///
+      /// Waiters are served in order, one quantum at a time: a large transfer
+      /// is queued again behind smaller ones after each quantum.
+      class RateLimiter:
+        public elle::Printable
+      {
+      /*-------------.
+      | Construction |
+      `-------------*/
+      public:
+        /// \param rate  Bytes per second, 0 for no limit.
+        /// \param burst Bytes that may be consumed at once after idling.
+        RateLimiter(uint64_t rate, std::size_t burst = 256 * 1024);
+        RateLimiter(RateLimiter const&) = delete;
+
+      /*------------.
+      | Consumption |
+      `------------*/
+      public:
+        /// Wait until size bytes may be sent.
+        void
+        consume(std::size_t size);
+        /// Bytes consumed by a single turn in the queue.
+        static std::size_t const quantum;
+
+      private:
+        void
+        _consume(std::size_t size);
+        void
+        _refill();
+        ELLE_ATTRIBUTE_R(uint64_t, rate);
+        ELLE_ATTRIBUTE_R(std::size_t, burst);
+        ELLE_ATTRIBUTE(double, tokens);
+        ELLE_ATTRIBUTE(boost::posix_time::ptime, refilled);
+        /// Coroutines waiting for their turn, the first one being served.
+        ELLE_ATTRIBUTE(std::list<reactor::Barrier*>, queue);
+
+      /*----------.
+      | Printable |
+      `----------*/
+      public:
+        void
+        print(std::ostream& stream) const override;
+      };
+    }
+  }
+}
+
+#endif
@@ -2,14 +2,25 @@
 
 #include <infinit/oracles/apertus/Apertus.hh>
 
+#include <reactor/Barrier.hh>
 #include <reactor/network/exception.hh>
 #include <reactor/network/socket.hh>
+#include <reactor/network/tcp-socket.hh>
 #include <reactor/scheduler.hh>
 #include <reactor/Scope.hh>
 
+#include <elle/Error.hh>
 #include <elle/finally.hh>
 #include <elle/log.hh>
 
+#ifdef INFINIT_LINUX
+# include <cerrno>
+# include <cstring>
+
+# include <fcntl.h>
+# include <unistd.h>
+#endif
+
 ELLE_LOG_COMPONENT("infinit.oracles.apertus.Transfer");
 
 namespace infinit
@@ -23,6 +34,12 @@ namespace infinit
                          Socket&& left,
                          Socket&& right):
         Waitable(elle::sprintf("transfer %s", tid)),
+        _memory(0),
+        _limiter(owner._transfer_rate_limit),
+        _transferred(0),
+        _rate(0),
+        _rate_transferred(0),
+        _started(boost::posix_time::microsec_clock::universal_time()),
         _apertus(owner),
         _tid(tid),
         _left(std::move(left)),
@@ -42,34 +59,196 @@ namespace infinit
         this->_right.reset();
       }
 
+      /// Initial relay buffer size, enough for idle and slow connections.
+      static std::size_t const buffer_size_min = 64 * 1024;
+      /// Relay buffer size for sustained throughput.
+      static std::size_t const buffer_size_max = 16 * 1024 * 1024;
+      /// Consecutive full reads before growing the buffer.
+      static int const buffer_grow_reads = 4;
+      /// Consecutive reads under a quarter of the buffer before shrinking it.
+      static int const buffer_shrink_reads = 64;
+
       void
-      Transfer::_handle(Socket& lhs, Socket& rhs)
+      Transfer::_handle(Socket& lhs, Socket& rhs, BufferPool::Buffer& buffer)
       {
-        static const uint32_t buff_size = 1024 * 1024 * 16;
-
-        std::string sbuff(buff_size, 0);
-        char* buff = &sbuff[0];
-        reactor::network::Buffer recv(buff, buff_size);
-
+        auto& pool = this->_apertus._buffers;
+        this->_memory += buffer.size();
+        elle::SafeFinally release([&] { this->_memory -= buffer.size(); });
+        // Swap to a buffer of another size if the pool can spare it.
+        auto resize = [&] (std::size_t size)
+          {
+            auto previous = buffer.size();
+            if (size < previous)
+            {
+              // Give the larger buffer back first: the smaller one then
+              // always fits in the budget.
+              {
+                auto released = std::move(buffer);
+              }
+              buffer = pool.acquire(size);
+            }
+            else if (auto replacement = pool.try_acquire(size))
+              buffer = std::move(*replacement);
+            else
+              return;
+            ELLE_DEBUG("%s: resize buffer from %s to %s bytes",
+                       this->_tid, previous, size);
+            this->_memory = this->_memory - previous + size;
+          };
+        int full = 0;
+        int small = 0;
         while (true)
         {
           ELLE_TRACE("wait for stuff to be readable");
           ELLE_ASSERT(lhs != nullptr);
+          reactor::network::Buffer recv(buffer.data(), buffer.size());
           uint32_t size = lhs->read_some(recv);
-          elle::ConstWeakBuffer send(buff, size);
+          elle::ConstWeakBuffer send(buffer.data(), size);
           ELLE_DEBUG("%s: read %s bytes from %s", this->_tid, size, *lhs);
           if (!send.empty())
           {
             ELLE_DUMP("%s", send);
+            this->_shape(size);
             ELLE_ASSERT(rhs != nullptr);
             rhs->write(send);
             ELLE_DEBUG("%s: write %s bytes to %s", this->_tid, size, *rhs);
-
-            this->_apertus.add_to_bandwidth(size);
+            this->_account(size);
+          }
+          full = size == buffer.size() ? full + 1 : 0;
+          small = size < buffer.size() / 4 ? small + 1 : 0;
+          if (full >= buffer_grow_reads && buffer.size() < buffer_size_max)
+          {
+            resize(buffer.size() * 2);
+            full = 0;
+          }
+          else if (small >= buffer_shrink_reads &&
+                   buffer.size() > buffer_size_min)
+          {
+            resize(buffer.size() / 2);
+            small = 0;
           }
         }
       }
 
+#ifdef INFINIT_LINUX
+      /// Bytes moved by a single splice call.
+      static std::size_t const splice_chunk = 1024 * 1024;
+
+      /// Wait until the socket is readable, or writable.
+      static
+      void
+      _wait_ready(reactor::network::TCPSocket& socket, bool write)
+      {
+        auto ready = std::make_shared<reactor::Barrier>(
+          elle::sprintf("%s %s", socket, write ? "writable" : "readable"));
+        auto handler = [ready] (boost::system::error_code const& error,
+                                std::size_t)
+          {
+            if (error != boost::asio::error::operation_aborted)
+              ready->open();
+          };
+        auto& asio = *socket.socket();
+        if (write)
+          asio.async_write_some(boost::asio::null_buffers(), handler);
+        else
+          asio.async_read_some(boost::asio::null_buffers(), handler);
+        elle::SafeFinally cancel(
+          [&]
+          {
+            if (!ready->opened())
+              asio.cancel();
+          });
+        reactor::wait(*ready);
+      }
+
+      void
+      Transfer::_splice(reactor::network::TCPSocket& lhs,
+                        reactor::network::TCPSocket& rhs)
+      {
+        ELLE_TRACE_SCOPE("%s: splice %s to %s", this->_tid, lhs, rhs);
+        int pipe[2];
+        if (::pipe2(pipe, O_NONBLOCK | O_CLOEXEC) != 0)
+          throw elle::Error(
+            elle::sprintf("unable to create pipe: %s", ::strerror(errno)));
+        elle::SafeFinally close(
+          [&]
+          {
+            ::close(pipe[0]);
+            ::close(pipe[1]);
+          });
+        int in = lhs.socket()->native_handle();
+        int out = rhs.socket()->native_handle();
+        auto splice = [this] (int from, int to, std::size_t size,
+                              reactor::network::TCPSocket& socket,
+                              bool write) -> std::size_t
+          {
+            while (true)
+            {
+              ssize_t res = ::splice(from, nullptr, to, nullptr, size,
+                                     SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+              if (res > 0)
+                return res;
+              if (res == 0)
+                throw reactor::network::ConnectionClosed();
+              if (errno == EINTR)
+                continue;
+              if (errno == EAGAIN)
+              {
+                _wait_ready(socket, write);
+                continue;
+              }
+              if (errno == ECONNRESET || errno == EPIPE)
+                throw reactor::network::ConnectionClosed();
+              throw reactor::network::Exception(
+                elle::sprintf("splice failed: %s", ::strerror(errno)));
+            }
+          };
+        while (true)
+        {
+          std::size_t size = splice(in, pipe[1], splice_chunk, lhs, false);
+          ELLE_DEBUG("%s: spliced %s bytes from %s", this->_tid, size, lhs);
+          this->_shape(size);
+          for (std::size_t left = size; left > 0;)
+            left -= splice(pipe[0], out, left, rhs, true);
+          ELLE_DEBUG("%s: spliced %s bytes to %s", this->_tid, size, rhs);
+          this->_account(size);
+        }
+      }
+#endif
+
+      /*--------.
+      | Shaping |
+      `--------*/
+
+      void
+      Transfer::_shape(std::size_t size)
+      {
+        // Wait for this transfer's own allowance before queuing for the
+        // global one, not to hold a turn other transfers could use.
+        this->_limiter.consume(size);
+        this->_apertus._rate_limiter.consume(size);
+      }
+
+      void
+      Transfer::_account(std::size_t size)
+      {
+        this->_transferred += size;
+        this->_apertus.add_to_bandwidth(size);
+      }
+
+      void
+      Transfer::_rate_update(boost::posix_time::time_duration const& elapsed)
+      {
+        auto bytes = this->_transferred - this->_rate_transferred;
+        this->_rate_transferred = this->_transferred;
+        auto ms = elapsed.total_milliseconds();
+        this->_rate = ms > 0 ? bytes * 1000 / ms : 0;
+      }
+
+      /*----------.
+      | Relaying |
+      `----------*/
+
       void
       Transfer::_run()
       {
@@ -86,20 +265,53 @@ namespace infinit
 
         try
         {
+          // Outlive the relay threads, which the scope may terminate only
+          // once unwound.
+          std::vector<BufferPool::Buffer> buffers;
           elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
           {
+#ifdef INFINIT_LINUX
+            // Plain TCP payloads need no user space processing: let the
+            // kernel move them between the sockets. SSL has to be deciphered
+            // and ciphered again, which only the buffered relay can do.
+            auto tcp_left =
+              dynamic_cast<reactor::network::TCPSocket*>(this->_left.get());
+            auto tcp_right =
+              dynamic_cast<reactor::network::TCPSocket*>(this->_right.get());
+            if (tcp_left != nullptr && tcp_right != nullptr)
+            {
+              scope.run_background(
+                elle::sprintf("%s: ltr", this->_tid),
+                [this, tcp_left, tcp_right]
+                {
+                  this->_splice(*tcp_left, *tcp_right);
+                });
+              scope.run_background(
+                elle::sprintf("%s: rtl", this->_tid),
+                [this, tcp_left, tcp_right]
+                {
+                  this->_splice(*tcp_right, *tcp_left);
+                });
+              scope.wait();
+              return;
+            }
+#endif
+            // Acquire both directions buffers at once: one holding its buffer
+            // while the other waits for the budget would pin memory without
+            // relaying anything.
+            buffers = this->_apertus._buffers.acquire(buffer_size_min, 2);
             scope.run_background(
               elle::sprintf("%s: ltr", this->_tid),
-              [this]
+              [this, &buffers]
               {
-                this->_handle(this->_left, this->_right);
+                this->_handle(this->_left, this->_right, buffers[0]);
               });
 
             scope.run_background(
               elle::sprintf("%s: rtl", this->_tid),
-              [this]
+              [this, &buffers]
               {
-                this->_handle(this->_right, this->_left);
+                this->_handle(this->_right, this->_left, buffers[1]);
               });
 
             scope.wait();
@@ -2,6 +2,7 @@
 # define INFINIT_ORACLES_APERTUS_TRANSFER_HH
 
 # include <infinit/oracles/apertus/Apertus.hh>
+# include <infinit/oracles/apertus/RateLimiter.hh>
 
 # include <reactor/network/fwd.hh>
 # include <reactor/thread.hh>
@@ -37,8 +38,41 @@ namespace infinit
         _run();
 
       private:
+        /// Relay from lhs to rhs through buffer, resizing it to the rate.
         void
-        _handle(Socket&, Socket&);
+        _handle(Socket& lhs, Socket& rhs, BufferPool::Buffer& buffer);
+# ifdef INFINIT_LINUX
+        /// Relay plain TCP through a pipe without copying to user space.
+        void
+        _splice(reactor::network::TCPSocket& lhs,
+                reactor::network::TCPSocket& rhs);
+# endif
+
+        /// Bytes of relay buffers held, in both directions.
+        ELLE_ATTRIBUTE_R(std::size_t, memory);
+
+      /*--------.
+      | Shaping |
+      `--------*/
+      private:
+        /// Wait for the rate limits to allow relaying size bytes.
+        void
+        _shape(std::size_t size);
+        /// Record size relayed bytes.
+        void
+        _account(std::size_t size);
+        /// Compute the rate over the last elapsed period.
+        void
+        _rate_update(boost::posix_time::time_duration const& elapsed);
+        /// Limit shared by both directions.
+        ELLE_ATTRIBUTE(RateLimiter, limiter);
+        /// Bytes relayed, in both directions.
+        ELLE_ATTRIBUTE_R(uint64_t, transferred);
+        /// Bytes per second over the last monitoring period.
+        ELLE_ATTRIBUTE_R(uint64_t, rate);
+        ELLE_ATTRIBUTE(uint64_t, rate_transferred);
+        ELLE_ATTRIBUTE_R(boost::posix_time::ptime, started);
+        friend class Apertus;
 
         ELLE_ATTRIBUTE(Apertus&, apertus);
         ELLE_ATTRIBUTE_R(Apertus::TID, tid);
@@ -10,6 +10,8 @@ namespace infinit
       class Apertus;
       class Transfer;
       class Accepter;
+      class BufferPool;
+      class RateLimiter;
     }
   }
 }
@@ -2,14 +2,22 @@
 #include <boost/program_options.hpp>
 
 #include <elle/Exception.hh>
+#include <elle/finally.hh>
 #include <elle/log/SysLogger.hh>
 #include <elle/log.hh>
 
 #include <reactor/scheduler.hh>
+#include <reactor/thread.hh>
 
 #include <infinit/oracles/apertus/Apertus.hh>
 #include <version.hh>
 
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 
 static
 boost::program_options::variables_map
@@ -25,6 +33,11 @@ parse_options(int argc, char** argv)
      "specify the meta protocol://host[:port] to connect to")
     ("tick,t", value<long>(), "specify the rate at which to announce the load to meta")
     ("client-timeout", value<int>(), "specify timeout in seconds after which non-paired clients are disconnected (300sec)")
+    ("memory", value<std::size_t>(), "specify the memory budget in MiB for relay buffers (1024)")
+    ("rate-limit", value<uint64_t>(), "specify the total relay bandwidth in KiB/s (unlimited)")
+    ("transfer-rate-limit", value<uint64_t>(), "specify the bandwidth of each transfer in KiB/s (unlimited)")
+    ("stats-port", value<int>(), "specify the local port serving JSON statistics, plus the shard index (disabled)")
+    ("shards,j", value<int>(), "specify the number of relay instances to run on separate cores, each on the given ports plus twice its index (1)")
     ("syslog,s", "send logs to the system logger")
     ("version,v", "display version information and exit")
     ;
@@ -61,6 +74,90 @@ parse_options(int argc, char** argv)
   return vm;
 }
 
+/// Run one apertus instance on its own scheduler until it stops.
+///
+/// Each shard registers to meta separately, which hands out a single shard to
+/// both ends of a transaction: shards never have to pair clients together.
+///
+/// While running, \a stop is set under \a mutex to a function that asks the
+/// shard to stop from any other thread.
+static
+void
+run_shard(std::string const& meta_protocol,
+          std::string const& meta_host,
+          int meta_port,
+          int port_ssl,
+          int port_tcp,
+          boost::posix_time::time_duration const& tick,
+          boost::posix_time::time_duration const& client_timeout,
+          std::size_t memory,
+          uint64_t rate_limit,
+          uint64_t transfer_rate_limit,
+          int port_stats,
+          std::mutex& mutex,
+          std::function<void ()>& stop)
+{
+  reactor::Scheduler sched;
+
+  std::unique_ptr<infinit::oracles::apertus::Apertus> apertus;
+  bool stopping = false;
+  auto shutdown = [&]
+    {
+      stopping = true;
+      if (apertus)
+        apertus->stop();
+    };
+
+  reactor::Thread main(sched, "main", [&]
+    {
+      if (stopping)
+        return;
+      apertus.reset(
+        new infinit::oracles::apertus::Apertus(
+          meta_protocol,
+          meta_host,
+          meta_port,
+          "0.0.0.0",
+          port_ssl,
+          port_tcp,
+          tick,
+          client_timeout,
+          memory,
+          rate_limit,
+          transfer_rate_limit));
+      if (port_stats != -1)
+        apertus->serve_stats(port_stats);
+
+      // Asked to stop while starting.
+      if (stopping)
+        apertus->stop();
+      else
+        reactor::wait(*apertus);
+      apertus.reset();
+    });
+
+  sched.signal_handle(SIGINT, shutdown);
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stop = [&sched, &shutdown]
+      {
+        sched.io_service().post(
+          [&sched, &shutdown]
+          {
+            new reactor::Thread(sched, "stop", shutdown, true);
+          });
+      };
+  }
+  elle::SafeFinally unregister(
+    [&]
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stop = nullptr;
+    });
+  sched.run();
+}
+
 int main(int argc, char** argv)
 {
   try
@@ -98,6 +195,11 @@ int main(int argc, char** argv)
     int port_tcp = 0;
     auto tick = 10_sec;
     auto client_timeout = 300_sec;
+    std::size_t memory = 1024;
+    uint64_t rate_limit = 0;
+    uint64_t transfer_rate_limit = 0;
+    int port_stats = -1;
+    int shards = 1;
 
     if (options.count("port-ssl"))
       port_ssl = options["port-ssl"].as<int>();
@@ -107,37 +209,60 @@ int main(int argc, char** argv)
       tick = boost::posix_time::seconds(options["tick"].as<long>());
    if (options.count("client-timeout"))
       client_timeout = boost::posix_time::seconds(options["client-timeout"].as<int>());
+    if (options.count("memory"))
+      memory = options["memory"].as<std::size_t>();
+    if (options.count("rate-limit"))
+      rate_limit = options["rate-limit"].as<uint64_t>();
+    if (options.count("transfer-rate-limit"))
+      transfer_rate_limit = options["transfer-rate-limit"].as<uint64_t>();
+    if (options.count("stats-port"))
+      port_stats = options["stats-port"].as<int>();
+    if (options.count("shards"))
+      shards = options["shards"].as<int>();
+    if (shards < 1)
+      throw elle::Exception("the number of shards must be positive");
 
-    reactor::Scheduler sched;
-
-    std::unique_ptr<infinit::oracles::apertus::Apertus> apertus;
-
-    reactor::Thread main(sched, "main", [&]
-      {
-        apertus.reset(
-          new infinit::oracles::apertus::Apertus(
-            meta_protocol,
-            meta_host,
-            meta_port,
-            "0.0.0.0",
-            port_ssl,
-            port_tcp,
-            tick,
-            client_timeout));
-
-        reactor::wait(*apertus);
-        apertus.reset();
-      });
-
-    sched.signal_handle(
-      SIGINT,
-      [&]
+    // Listening on the same ports in every shard would split the two ends of
+    // a transaction between them: use distinct ports, unless picked randomly.
+    auto port = [] (int base, int shard)
       {
-        if (apertus)
-          apertus->stop();
-      });
-
-    sched.run();
+        return base == 0 ? 0 : base + 2 * shard;
+      };
+    // A failing shard stops the others, so the process exits promptly and
+    // reports the error.
+    std::exception_ptr error;
+    std::mutex mutex;
+    std::vector<std::function<void ()>> stop(shards);
+    std::vector<std::thread> threads;
+    for (int shard = 0; shard < shards; ++shard)
+      threads.emplace_back(
+        [&, shard]
+        {
+          try
+          {
+            run_shard(meta_protocol, meta_host, meta_port,
+                      port(port_ssl, shard), port(port_tcp, shard),
+                      tick, client_timeout,
+                      memory * 1024 * 1024 / shards,
+                      rate_limit * 1024 / shards,
+                      transfer_rate_limit * 1024,
+                      port_stats <= 0 ? port_stats : port_stats + shard,
+                      mutex, stop[shard]);
+          }
+          catch (...)
+          {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error)
+              error = std::current_exception();
+            for (auto const& s: stop)
+              if (s)
+                s();
+          }
+        });
+    for (auto& thread: threads)
+      thread.join();
+    if (error)
+      std::rethrow_exception(error);
   }
   catch (std::exception const& e)
   {
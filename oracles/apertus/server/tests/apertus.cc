@@ -1,6 +1,8 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <ctime>
+
 #include <elle/json/json.hh>
 #include <elle/log.hh>
 #include <elle/network/hostname.hh>
@@ -734,6 +736,261 @@ ELLE_TEST_SCHEDULED(first_client_left)
   BOOST_CHECK_THROW(socket2.read(1, 1_sec), reactor::network::ConnectionClosed);
 }
 
+/*------------.
+| buffer_pool |
+`------------*/
+
+// Check relay buffers are reused and the memory budget applies backpressure.
+
+ELLE_TEST_SCHEDULED(buffer_pool)
+{
+  using infinit::oracles::apertus::BufferPool;
+  BufferPool pool(1024);
+  {
+    auto b1 = pool.acquire(512);
+    auto b2 = pool.acquire(256);
+    BOOST_CHECK_EQUAL(pool.used(), 768);
+    BOOST_CHECK(!pool.try_acquire(512));
+    bool acquired = false;
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+    {
+      scope.run_background("wait", [&]
+      {
+        auto b3 = pool.acquire(512);
+        acquired = true;
+      });
+      reactor::yield();
+      reactor::yield();
+      BOOST_CHECK(!acquired);
+      {
+        auto released = std::move(b1);
+      }
+      scope.wait();
+    };
+    BOOST_CHECK(acquired);
+  }
+  BOOST_CHECK_EQUAL(pool.used(), 0);
+  BOOST_CHECK_EQUAL(pool.allocated(), 768);
+  // Cached buffers are freed to make room for other sizes.
+  {
+    auto b = pool.acquire(1024);
+    BOOST_CHECK_EQUAL(pool.used(), 1024);
+    BOOST_CHECK_EQUAL(pool.allocated(), 1024);
+  }
+  // Several buffers are acquired together, none is held while waiting.
+  auto b = pool.acquire(512);
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    bool acquired = false;
+    scope.run_background("wait", [&]
+    {
+      auto buffers = pool.acquire(256, 3);
+      BOOST_CHECK_EQUAL(buffers.size(), 3);
+      acquired = true;
+    });
+    reactor::yield();
+    reactor::yield();
+    BOOST_CHECK(!acquired);
+    BOOST_CHECK_EQUAL(pool.used(), 512);
+    {
+      auto released = std::move(b);
+    }
+    scope.wait();
+    BOOST_CHECK(acquired);
+  };
+}
+
+/*--------------.
+| handshake_max |
+`--------------*/
+
+// Check clients beyond the handshake limit wait for a slot.
+
+ELLE_TEST_SCHEDULED(handshake_max)
+{
+  Meta meta;
+  infinit::oracles::apertus::Apertus apertus(
+    "http",
+    "localhost",
+    meta.port(),
+    "localhost",
+    0,
+    0,
+    1_sec);
+  reactor::wait(meta.apertus_registered());
+  apertus.handshake_max(1);
+  auto until = [] (std::function<bool ()> const& condition)
+    {
+      while (!condition())
+        reactor::sleep(10_ms);
+    };
+  auto port = boost::lexical_cast<std::string>(apertus.port_tcp());
+  reactor::network::TCPSocket stalled("127.0.0.1", port);
+  until([&] { return apertus.handshakes() == 1; });
+  reactor::network::TCPSocket queued("127.0.0.1", port);
+  queued.write(elle::ConstWeakBuffer(elle::sprintf(" %s", std::string(32, 'q'))));
+  until([&] { return apertus.handshakes_queued() == 1; });
+  reactor::sleep(100_ms);
+  BOOST_CHECK_EQUAL(apertus.handshakes(), 1);
+  BOOST_CHECK_EQUAL(apertus.clients().size(), 0);
+  stalled.write(elle::ConstWeakBuffer(elle::sprintf(" %s", std::string(32, 's'))));
+  until([&] { return apertus.clients().size() == 2; });
+  BOOST_CHECK_EQUAL(apertus.handshakes(), 0);
+  BOOST_CHECK_EQUAL(apertus.handshakes_queued(), 0);
+}
+
+/*------.
+| stats |
+`------*/
+
+// Check the stats endpoint reports running transfers.
+
+ELLE_TEST_SCHEDULED(stats)
+{
+  Meta meta;
+  infinit::oracles::apertus::Apertus apertus(
+    "http",
+    "localhost",
+    meta.port(),
+    "localhost",
+    0,
+    0,
+    valgrind(1_sec));
+  reactor::wait(meta.apertus_registered());
+  apertus.serve_stats();
+  auto port = boost::lexical_cast<std::string>(apertus.port_tcp());
+  std::string passphrase(32, 'x');
+  reactor::network::TCPSocket socket1("127.0.0.1", port);
+  socket1.write(elle::ConstWeakBuffer(elle::sprintf(" %s", passphrase)));
+  reactor::network::TCPSocket socket2("127.0.0.1", port);
+  socket2.write(elle::ConstWeakBuffer(elle::sprintf(" %s", passphrase)));
+  std::string const some_stuff = "By the Power of Grayskull";
+  socket1.write(some_stuff);
+  BOOST_CHECK_EQUAL(socket2.read_until(some_stuff), some_stuff);
+  reactor::network::TCPSocket client(
+    "127.0.0.1", boost::lexical_cast<std::string>(apertus.port_stats()));
+  auto stats = boost::any_cast<elle::json::Object>(elle::json::read(client));
+  BOOST_CHECK_EQUAL(boost::any_cast<int64_t>(stats.at("transferred")),
+                    some_stuff.size());
+  auto transfers =
+    boost::any_cast<elle::json::Array>(stats.at("transfers"));
+  BOOST_CHECK_EQUAL(transfers.size(), 1);
+  auto transfer = boost::any_cast<elle::json::Object>(transfers.front());
+  BOOST_CHECK_EQUAL(boost::any_cast<std::string>(transfer.at("tid")),
+                    passphrase);
+  BOOST_CHECK_EQUAL(boost::any_cast<int64_t>(transfer.at("transferred")),
+                    some_stuff.size());
+}
+
+/*-------------.
+| rate_limiter |
+`-------------*/
+
+// Check the token bucket throttles consumers and serves them in turns.
+
+ELLE_TEST_SCHEDULED(rate_limiter)
+{
+  using infinit::oracles::apertus::RateLimiter;
+  std::size_t const quantum = RateLimiter::quantum;
+  RateLimiter limiter(quantum * 10, quantum);
+  auto start = boost::posix_time::microsec_clock::universal_time();
+  // The initial burst is free, the next five quanta take half a second.
+  limiter.consume(quantum * 6);
+  auto elapsed = boost::posix_time::microsec_clock::universal_time() - start;
+  BOOST_CHECK_GE(elapsed, 450_ms);
+  // Concurrent consumers are served one quantum at a time, in turns.
+  std::vector<std::string> order;
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background("first", [&]
+    {
+      for (int i = 0; i < 3; ++i)
+      {
+        limiter.consume(quantum);
+        order.push_back("first");
+      }
+    });
+    scope.run_background("second", [&]
+    {
+      for (int i = 0; i < 3; ++i)
+      {
+        limiter.consume(quantum);
+        order.push_back("second");
+      }
+    });
+    scope.wait();
+  };
+  std::vector<std::string> expected =
+    {"first", "second", "first", "second", "first", "second"};
+  BOOST_CHECK_EQUAL_COLLECTIONS(order.begin(), order.end(),
+                                expected.begin(), expected.end());
+  // No limit never waits.
+  RateLimiter unlimited(0);
+  unlimited.consume(1024 * 1024 * 1024);
+}
+
+/*------------------.
+| relay_throughput |
+`------------------*/
+
+// Relay a payload through plain TCP and SSL pairs and report the CPU time per
+// gigabyte: plain TCP pairs are spliced in the kernel on Linux.
+
+template <typename Socket, typename ... Args>
+static
+double
+relay_cpu(infinit::oracles::apertus::Apertus& apertus,
+          std::string const& passphrase,
+          std::size_t size,
+          int port,
+          Args const& ... args)
+{
+  Socket socket1("127.0.0.1", boost::lexical_cast<std::string>(port), args...);
+  socket1.write(elle::ConstWeakBuffer(elle::sprintf(" %s", passphrase)));
+  Socket socket2("127.0.0.1", boost::lexical_cast<std::string>(port), args...);
+  socket2.write(elle::ConstWeakBuffer(elle::sprintf(" %s", passphrase)));
+  std::clock_t start = std::clock();
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background("write", [&]
+    {
+      std::string chunk(1024 * 1024, 'a');
+      for (std::size_t sent = 0; sent < size; sent += chunk.size())
+        socket1.write(elle::ConstWeakBuffer(chunk));
+    });
+    std::unique_ptr<char[]> data(new char[1024 * 1024]);
+    std::size_t received = 0;
+    while (received < size)
+      received += socket2.read_some(
+        reactor::network::Buffer(data.get(), 1024 * 1024));
+    BOOST_CHECK_EQUAL(received, size);
+    scope.wait();
+  };
+  double cpu = double(std::clock() - start) / CLOCKS_PER_SEC;
+  return cpu * (1024. * 1024. * 1024.) / size;
+}
+
+ELLE_TEST_SCHEDULED(relay_throughput)
+{
+  Meta meta;
+  infinit::oracles::apertus::Apertus apertus(
+    "http",
+    "localhost",
+    meta.port(),
+    "localhost",
+    0,
+    0,
+    valgrind(1_sec));
+  reactor::wait(meta.apertus_registered());
+  std::size_t const size = (RUNNING_ON_VALGRIND ? 16 : 256) * 1024 * 1024;
+  auto tcp = relay_cpu<reactor::network::TCPSocket>(
+    apertus, std::string(32, 't'), size, apertus.port_tcp());
+  ELLE_LOG("TCP relay: %.2fs of CPU per GB", tcp);
+  auto ssl = relay_cpu<reactor::network::FingerprintedSocket>(
+    apertus, std::string(32, 's'), size, apertus.port_ssl(), fingerprint);
+  ELLE_LOG("SSL relay: %.2fs of CPU per GB", ssl);
+}
+
 ELLE_TEST_SUITE()
 {
   std::string s = elle::os::getenv("RANDOM_SEED", "");
@@ -754,4 +1011,9 @@ ELLE_TEST_SUITE()
   suite.add(BOOST_TEST_CASE(sync_bit), 0, timeout);
   suite.add(BOOST_TEST_CASE(concurrency_bug), 0, timeout);
   suite.add(BOOST_TEST_CASE(first_client_left), 0, timeout);
+  suite.add(BOOST_TEST_CASE(buffer_pool), 0, timeout);
+  suite.add(BOOST_TEST_CASE(handshake_max), 0, timeout);
+  suite.add(BOOST_TEST_CASE(stats), 0, timeout);
+  suite.add(BOOST_TEST_CASE(rate_limiter), 0, timeout);
+  suite.add(BOOST_TEST_CASE(relay_throughput), 0, timeout * 12);
 }
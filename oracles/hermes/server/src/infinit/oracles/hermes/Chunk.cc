@@ -1,5 +1,7 @@
 #include <infinit/oracles/hermes/Chunk.hh>
 
+#include <algorithm>
+
 namespace oracle
 {
   namespace hermes
@@ -23,10 +25,10 @@ namespace oracle
 
       try
       {
-        _id = boost::lexical_cast<int>(strings[0]);
-        _off = boost::lexical_cast<int>(strings[1]);
+        _id = boost::lexical_cast<FileID>(strings.at(0));
+        _off = boost::lexical_cast<Offset>(strings.at(1));
       }
-      catch (boost::bad_lexical_cast const&)
+      catch (std::exception const&)
       {
         throw elle::Exception("Invalid file in transaction folder");
       }
@@ -66,100 +68,73 @@ namespace oracle
       return _off >= oth._off and _off <= (oth._off + oth._size);
     }
 
-    void
-    Chunk::append(elle::Buffer& buff)
+    FileID
+    Chunk::id() const
     {
-      std::ofstream out(_path.string(), std::fstream::app);
-      if (not out.is_open())
-        throw elle::Exception("IO error: could not save file");
-
-      out.write(reinterpret_cast<char*>(buff.mutable_contents()), buff.size());
-      _size += buff.size();
-
-      out.close();
+      return _id;
     }
 
-    void
-    Chunk::save(elle::Buffer& buff)
+    Offset
+    Chunk::offset() const
     {
-      std::ofstream out(_path.string());
-      if (not out.is_open())
-        throw elle::Exception("IO error: could not save file");
+      return _off;
+    }
 
-      out.write(reinterpret_cast<char*>(buff.mutable_contents()), buff.size());
-      _size = buff.size();
+    Size
+    Chunk::size() const
+    {
+      return _size;
+    }
 
-      out.close();
+    Offset
+    Chunk::end() const
+    {
+      return _off + _size;
     }
 
     void
-    Chunk::merge(Chunk const& other, elle::Buffer& buff)
+    Chunk::append(FileCache& files, unsigned char const* data, Size size)
     {
-      // The function is called with this as the permanent chunk already stored
-      // and other as the search block.
-      if (_off < other._off)
-      {
-        std::ofstream out(_path.string(), std::fstream::app);
-        if (not out.is_open())
-          throw elle::Exception("IO error: could not save file");
-
-        Offset offset(_off + _size - other._off);
-        Size size(other._off + other._size - (_off + _size));
-
-        out.write(reinterpret_cast<char*>(buff.mutable_contents()) + offset,
-                  size);
-        _size += size;
-
-        out.close();
-        return;
-      }
-
-      // In such a case, data is not sent in order. TODO
-      throw elle::Exception("Transfert error: data was not sent in order");
+      files.write(_path, data, size, _size);
+      _size += size;
     }
 
     void
-    Chunk::prepend(Chunk& other, elle::Buffer& buff)
+    Chunk::save(FileCache& files, unsigned char const* data, Size size)
     {
-      std::ofstream out(other._path.string());
-      if (not out.is_open())
-        throw elle::Exception("IO error: could not save file");
-
-      out.write(reinterpret_cast<char*>(buff.mutable_contents()), buff.size());
-      other._size = buff.size();
-
-      Size file_size = boost::filesystem::file_size(_path);
-      std::ifstream in(_path.string());
+      files.open(_path, true);
+      files.write(_path, data, size, 0);
+      _size = size;
+    }
 
-      char* buffer = new char[2048];
-      while (not in.eof())
+    void
+    Chunk::absorb(FileCache& files, Chunk& next)
+    {
+      if (next._id != _id or next._off != _off + _size)
+        throw elle::Exception("Chunks are not contiguous");
+      Size const step = 1024 * 1024;
+      elle::Buffer buffer(std::min(step, next._size));
+      for (Offset done = 0; done < next._size; done += step)
       {
-        in.read(buffer, 2048);
-        out.write(buffer, in.gcount());
+        Size size = std::min(step, next._size - done);
+        files.read(next._path, buffer.mutable_contents(), size, done);
+        files.write(_path, buffer.contents(), size, _size + done);
       }
-      delete[] buffer;
-
-      in.close();
-      other._size += file_size;
-
-      out.close();
+      _size += next._size;
+      next.remove(files);
     }
 
-    elle::Buffer
-    Chunk::extract(Chunk const& piece) const
+    Extent
+    Chunk::locate(Chunk const& piece) const
     {
-      std::ifstream file(_path.string());
-      elle::Buffer ret(_off + _size - piece._off);
-
-      file.seekg(piece._off - _off);
-      file.read(reinterpret_cast<char*>(ret.mutable_contents()), piece._size);
-
-      return ret;
+      Size size = std::min(piece._size, _off + _size - piece._off);
+      return Extent{_path, piece._off - _off, size};
     }
 
     void
-    Chunk::remove()
+    Chunk::remove(FileCache& files)
     {
+      files.close(_path);
       boost::filesystem::remove(_path);
     }
 
@@ -4,19 +4,28 @@
 # include <boost/lexical_cast.hpp>
 # include <boost/algorithm/string.hpp>
 
-# include <fstream>
 # include <elle/Buffer.hh>
 # include <frete/Frete.hh>
 
+# include <infinit/oracles/hermes/FileCache.hh>
+
 namespace oracle
 {
   namespace hermes
   {
     typedef frete::Frete::FileID FileID;
-    typedef frete::Frete::Offset Offset;
-    typedef frete::Frete::Size Size;
+    typedef frete::Frete::FileOffset Offset;
+    typedef frete::Frete::FileSize Size;
     class Clerk;
 
+    /// A range of a block file.
+    struct Extent
+    {
+      boost::filesystem::path path;
+      Offset offset;
+      Size size;
+    };
+
     class Chunk
     {
     public:
@@ -37,23 +46,37 @@ namespace oracle
       belongs_to(Chunk const& other) const;
 
     public:
-      void
-      append(elle::Buffer& buff);
+      FileID
+      id() const;
 
+      Offset
+      offset() const;
+
+      Size
+      size() const;
+
+      /// Offset right after the last byte of the chunk.
+      Offset
+      end() const;
+
+    public:
       void
-      save(elle::Buffer& buff);
+      append(FileCache& files, unsigned char const* data, Size size);
 
       void
-      merge(Chunk const& other, elle::Buffer& buff);
+      save(FileCache& files, unsigned char const* data, Size size);
 
+      /// Append the content of the chunk right after this one and remove it.
       void
-      prepend(Chunk& other, elle::Buffer& buff);
+      absorb(FileCache& files, Chunk& next);
 
-      elle::Buffer
-      extract(Chunk const& piece) const;
+      /// Where the bytes of piece held by this chunk are, up to the end of
+      /// the chunk.
+      Extent
+      locate(Chunk const& piece) const;
 
       void
-      remove();
+      remove(FileCache& files);
 
     private:
       std::string _name();
@@ -4,7 +4,9 @@ namespace oracle
 {
   namespace hermes
   {
-    Clerk::Clerk(boost::filesystem::path& base_path):
+    Clerk::Clerk(boost::filesystem::path& base_path,
+                 FileCache& descriptors):
+      _descriptors(descriptors),
       _base_path(base_path),
       _identified(false)
     {}
@@ -27,7 +29,11 @@ namespace oracle
       for (boost::filesystem::directory_iterator it(_base_path);
            it != end; it++)
         if (boost::filesystem::is_regular_file(it->status()))
-          _chunks.push_back(it->path());
+        {
+          Chunk chunk(it->path());
+          _files[chunk.id()].emplace(chunk.offset(), chunk);
+          _dirty.insert(chunk.id());
+        }
         else
           throw elle::Exception("Invalid file in transaction folder");
     }
@@ -42,60 +48,167 @@ namespace oracle
       _identified = true;
     }
 
-    // TODO: Opti, fileID offset in vector table?
+    Clerk::Chunks::iterator
+    Clerk::_before(Chunks& chunks, Offset off)
+    {
+      auto it = chunks.upper_bound(off);
+      if (it == chunks.begin())
+        return chunks.end();
+      return --it;
+    }
+
+    // Blocks may come in any order and overlap stored ones: only the parts of
+    // a block not stored yet are written, appended to the chunk they follow or
+    // saved as new chunks.
     Size
     Clerk::store(FileID id, Offset off, elle::Buffer& buff)
     {
       if (not _identified)
         throw elle::Exception("Trying to store something without identifying");
 
-      Chunk chunk(_base_path, id, off, buff.size());
-
-      std::vector<Chunk>::iterator result;
-      auto cmpf = std::bind(&Chunk::follows, &chunk, std::placeholders::_1);
-      auto cmpo = std::bind(&Chunk::overlaps, &chunk, std::placeholders::_1);
-      auto cmpl = std::bind(&Chunk::leads, &chunk, std::placeholders::_1);
-
-      if ((result = std::find_if(_chunks.begin(), _chunks.end(), cmpf)) !=
-          _chunks.end())
-        result->append(buff);
-      else if ((result = std::find_if(_chunks.begin(), _chunks.end(), cmpo)) !=
-          _chunks.end())
-        result->merge(chunk, buff);
-      else if ((result = std::find_if(_chunks.begin(), _chunks.end(), cmpl)) !=
-          _chunks.end())
+      auto& chunks = _files[id];
+      Offset const end = off + buff.size();
+      Offset pos = off;
+      auto next = chunks.upper_bound(off);
+      auto prev = next == chunks.begin() ? chunks.end() : std::prev(next);
+      if (prev != chunks.end())
+        pos = std::max(pos, std::min(end, prev->second.end()));
+      while (pos < end)
       {
-        result->prepend(chunk, buff);
-        result->remove();
-        _chunks.erase(result);
-        _chunks.push_back(chunk);
-      }
-      else
-      {
-        chunk.save(buff);
-        _chunks.push_back(chunk);
+        Offset gap = next == chunks.end() ? end : std::min(end, next->first);
+        if (gap > pos)
+        {
+          unsigned char const* data = buff.contents() + (pos - off);
+          if (prev != chunks.end() and prev->second.end() == pos)
+            prev->second.append(_descriptors, data, gap - pos);
+          else
+          {
+            Chunk chunk(_base_path, id, pos, 0);
+            chunk.save(_descriptors, data, gap - pos);
+            prev = chunks.emplace(pos, chunk).first;
+          }
+          _dirty.insert(id);
+        }
+        if (next == chunks.end())
+          break;
+        pos = std::min(end, next->second.end());
+        prev = next++;
       }
 
       return buff.size();
     }
 
+    Size
+    Clerk::coalesce(Size budget, Size limit)
+    {
+      Size copied = 0;
+      auto file = _dirty.begin();
+      while (file != _dirty.end() and copied < budget)
+      {
+        auto& chunks = _files[*file];
+        bool pending = false;
+        for (auto it = chunks.begin(); it != chunks.end(); )
+        {
+          auto next = std::next(it);
+          if (next == chunks.end())
+            break;
+          if (it->second.end() != next->first)
+            ++it;
+          else if (copied + next->second.size() <= budget)
+          {
+            it->second.absorb(_descriptors, next->second);
+            copied += next->second.size();
+            chunks.erase(next);
+          }
+          else
+          {
+            // Retry later chunks that a whole round could copy, leave
+            // larger ones linked for good.
+            if (next->second.size() <= limit)
+              pending = true;
+            ++it;
+          }
+        }
+        if (pending)
+          ++file;
+        else
+          file = _dirty.erase(file);
+      }
+      return copied;
+    }
+
     elle::Buffer
     Clerk::fetch(FileID id, Offset off, Size size)
     {
       if (not _identified)
         throw elle::Exception("Trying to fetch something without identifying");
 
-      elle::Buffer ret;
+      std::vector<Extent> extents = locate(id, off, size);
+      Size total = 0;
+      for (auto const& extent: extents)
+        total += extent.size;
+      elle::Buffer ret(total);
+      unsigned char* data = ret.mutable_contents();
+      for (auto const& extent: extents)
+      {
+        _descriptors.read(extent.path, data, extent.size, extent.offset);
+        data += extent.size;
+      }
+      return ret;
+    }
+
+    std::vector<Extent>
+    Clerk::locate(FileID id, Offset off, Size size)
+    {
+      if (not _identified)
+        throw elle::Exception("Trying to fetch something without identifying");
 
       Chunk chunk(_base_path, id, off, size);
-      std::vector<Chunk>::const_iterator result;
-      auto cmpb = std::bind(&Chunk::belongs_to, &chunk, std::placeholders::_1);
+      auto file = _files.find(id);
+      if (file == _files.end())
+        throw elle::Exception("Chunk not found");
+      auto& chunks = file->second;
+      auto it = _before(chunks, off);
+      if (it == chunks.end() or not chunk.belongs_to(it->second))
+        throw elle::Exception("Chunk not found");
+
+      // Continue through the chunks linked right after this one.
+      std::vector<Extent> ret;
+      Offset pos = off;
+      Offset end = off + size;
+      for (; it != chunks.end() and pos < end and
+             it->second.offset() <= pos and pos <= it->second.end();
+           ++it)
+      {
+        Extent extent =
+          it->second.locate(Chunk(_base_path, id, pos, end - pos));
+        if (extent.size == 0)
+          continue;
+        ret.push_back(extent);
+        pos += extent.size;
+      }
+      return ret;
+    }
 
-      if ((result = std::find_if(_chunks.begin(), _chunks.end(), cmpb)) !=
-          _chunks.end())
-        return result->extract(chunk);
+    int
+    Clerk::open(Extent const& extent)
+    {
+      return _descriptors.open(extent.path);
+    }
 
-      throw elle::Exception("Chunk not found");
+    void
+    Clerk::remove()
+    {
+      if (not _identified)
+        throw elle::Exception("Trying to remove something without identifying");
+
+      for (auto& file: _files)
+        for (auto& chunk: file.second)
+          chunk.second.remove(_descriptors);
+      _files.clear();
+      _dirty.clear();
+      boost::filesystem::remove_all(_base_path);
+      _identified = false;
     }
   }
 }
@@ -7,11 +7,15 @@
 
 # include <algorithm>
 # include <fstream>
+# include <map>
+# include <set>
+# include <unordered_map>
 # include <vector>
 
 # include <elle/Buffer.hh>
 
 # include <infinit/oracles/hermes/Chunk.hh>
+# include <infinit/oracles/hermes/FileCache.hh>
 
 namespace oracle
 {
@@ -22,7 +26,8 @@ namespace oracle
     class Clerk
     {
     public:
-      Clerk(boost::filesystem::path& base_path);
+      /// Block files are opened through descriptors, shared by all clerks.
+      Clerk(boost::filesystem::path& base_path, FileCache& descriptors);
 
       static
       void
@@ -38,12 +43,46 @@ namespace oracle
       elle::Buffer
       fetch(FileID id, Offset off, Size size);
 
+      /// The block file ranges holding the bytes fetch would return.
+      std::vector<Extent>
+      locate(FileID id, Offset off, Size size);
+
+      /// A descriptor for an extent file, valid until another file is
+      /// opened through the shared cache.
+      int
+      open(Extent const& extent);
+
+      /// Delete the blocks of the transaction. The clerk can't be used
+      /// afterwards.
+      void
+      remove();
+
+      /// Merge contiguous chunks, copying at most budget bytes.
+      ///
+      /// Files stay dirty while they have chunks of at most limit bytes left
+      /// to merge, the budget of a whole round.
+      ///
+      /// \return The number of bytes copied.
+      Size
+      coalesce(Size budget, Size limit);
+
     private:
       void
       _explore(boost::filesystem::path& path);
 
+      /// Chunks of a file, by offset.
+      typedef std::map<Offset, Chunk> Chunks;
+
+      /// The chunk holding off, or the last one before it, if any.
+      static
+      Chunks::iterator
+      _before(Chunks& chunks, Offset off);
+
     private:
-      std::vector<Chunk> _chunks;
+      std::unordered_map<FileID, Chunks> _files;
+      FileCache& _descriptors;
+      /// Files that may have contiguous chunks.
+      std::set<FileID> _dirty;
       boost::filesystem::path _base_path;
       bool _identified;
     };
@@ -0,0 +1,109 @@
+#include <infinit/oracles/hermes/FileCache.hh>
+
+#include <elle/Exception.hh>
+
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace oracle
+{
+  namespace hermes
+  {
+    FileCache::FileCache(std::size_t capacity):
+      _entries(),
+      _index(),
+      _capacity(capacity)
+    {}
+
+    FileCache::~FileCache()
+    {
+      for (auto const& entry: _entries)
+        ::close(entry.second);
+    }
+
+    int
+    FileCache::open(boost::filesystem::path const& path, bool truncate)
+    {
+      std::string const name = path.string();
+      if (truncate)
+        close(path);
+      auto it = _index.find(name);
+      if (it != _index.end())
+      {
+        _entries.splice(_entries.begin(), _entries, it->second);
+        return it->second->second;
+      }
+
+      int flags = O_RDWR | O_CREAT | (truncate ? O_TRUNC : 0);
+      int fd = ::open(name.c_str(), flags, 0600);
+      if (fd < 0)
+        throw elle::Exception("IO error: could not open file " + name + ": " +
+                              std::strerror(errno));
+      if (_entries.size() >= _capacity)
+      {
+        ::close(_entries.back().second);
+        _index.erase(_entries.back().first);
+        _entries.pop_back();
+      }
+      _entries.emplace_front(name, fd);
+      _index[name] = _entries.begin();
+      return fd;
+    }
+
+    void
+    FileCache::write(boost::filesystem::path const& path,
+                     unsigned char const* data,
+                     std::size_t size,
+                     std::uint64_t off)
+    {
+      int fd = open(path);
+      while (size > 0)
+      {
+        ssize_t res = ::pwrite(fd, data, size, off);
+        if (res < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          throw elle::Exception("IO error: could not save file");
+        }
+        data += res;
+        size -= res;
+        off += res;
+      }
+    }
+
+    void
+    FileCache::read(boost::filesystem::path const& path,
+                    unsigned char* data,
+                    std::size_t size,
+                    std::uint64_t off)
+    {
+      int fd = open(path);
+      while (size > 0)
+      {
+        ssize_t res = ::pread(fd, data, size, off);
+        if (res < 0 and errno == EINTR)
+          continue;
+        if (res <= 0)
+          throw elle::Exception("IO error: could not read file");
+        data += res;
+        size -= res;
+        off += res;
+      }
+    }
+
+    void
+    FileCache::close(boost::filesystem::path const& path)
+    {
+      auto it = _index.find(path.string());
+      if (it == _index.end())
+        return;
+      ::close(it->second->second);
+      _entries.erase(it->second);
+      _index.erase(it);
+    }
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef ORACLE_DISCIPLES_HERMES_FILE_CACHE_HH
+# define ORACLE_DISCIPLES_HERMES_FILE_CACHE_HH
+
+# include <boost/filesystem.hpp>
+
+# include <cstdint>
+# include <list>
+# include <string>
+# include <unordered_map>
+# include <utility>
+
+namespace oracle
+{
+  namespace hermes
+  {
+    /// Open block files, least recently used first out.
+    class FileCache
+    {
+    public:
+      FileCache(std::size_t capacity = 64);
+      ~FileCache();
+      FileCache(FileCache const&) = delete;
+      FileCache&
+      operator =(FileCache const&) = delete;
+
+    public:
+      /// A descriptor for reading and writing path, creating it if needed and
+      /// emptying it if truncate is set.
+      int
+      open(boost::filesystem::path const& path, bool truncate = false);
+
+      /// Write size bytes of data to path at off.
+      void
+      write(boost::filesystem::path const& path,
+            unsigned char const* data, std::size_t size, std::uint64_t off);
+
+      /// Read size bytes of path at off into data.
+      void
+      read(boost::filesystem::path const& path,
+           unsigned char* data, std::size_t size, std::uint64_t off);
+
+      /// Close path if it is open.
+      void
+      close(boost::filesystem::path const& path);
+
+    private:
+      typedef std::list<std::pair<std::string, int>> Entries;
+      Entries _entries;
+      std::unordered_map<std::string, Entries::iterator> _index;
+      std::size_t _capacity;
+    };
+  }
+}
+
+#endif // !ORACLE_DISCIPLES_HERMES_FILE_CACHE_HH
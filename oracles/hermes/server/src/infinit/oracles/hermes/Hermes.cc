@@ -1,70 +1,392 @@
 #include <infinit/oracles/hermes/Hermes.hh>
 
+#include <reactor/Barrier.hh>
+#include <reactor/Scope.hh>
+#include <reactor/exception.hh>
+#include <reactor/network/buffer.hh>
+#include <reactor/network/exception.hh>
+
+#include <elle/Exception.hh>
+#include <elle/finally.hh>
+#include <elle/log.hh>
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#ifdef INFINIT_LINUX
+# include <csignal>
+# include <sys/sendfile.h>
+#endif
+
+ELLE_LOG_COMPONENT("infinit.oracles.hermes.Hermes");
+
 using namespace std;
 
 namespace oracle
 {
   namespace hermes
   {
-    Hermes::Hermes(reactor::Scheduler& sched, int port, std::string base_path):
+    /// Bytes copied by each coalescing pass, not to stall clients.
+    static Size const coalesce_budget = 16 * 1024 * 1024;
+
+    /// Bytes sent by a single sendfile call, not to starve other clients.
+    static Size const send_chunk = 1024 * 1024;
+
+    static
+    void
+    encode(char* data, uint64_t value)
+    {
+      for (int i = 7; i >= 0; --i, value >>= 8)
+        data[i] = static_cast<char>(value & 0xff);
+    }
+
+    static
+    uint64_t
+    decode(char const* data)
+    {
+      uint64_t value = 0;
+      for (int i = 0; i < 8; ++i)
+        value = (value << 8) | static_cast<unsigned char>(data[i]);
+      return value;
+    }
+
+    Hermes::Hermes(reactor::Scheduler& sched,
+                   int port,
+                   std::string base_path,
+                   int stream_port):
       _sched(sched),
       _serv(sched),
+      _stream_serv(sched),
       _base_path(base_path),
-      _port(port)
+      _port(port),
+      _stream_port(stream_port),
+      _descriptors(256),
+      _clerks(),
+      _clerks_index(),
+      _clerks_max(256)
     {
       Clerk::check_directory(_base_path);
     }
 
     Hermes::~Hermes()
-    {
-      // TODO: Replace with unique_ptr.
-      for (auto client : _clients)
-        if (client != nullptr)
-        {
-          client->terminate_now();
-          delete client;
-        }
-    }
+    {}
 
     void
     Hermes::run()
     {
       _serv.listen(_port);
+      _port = _serv.port();
+      if (_stream_port >= 0)
+      {
+#ifdef INFINIT_LINUX
+        // Unlike asio sends, sendfile raises SIGPIPE on closed sockets.
+        ::signal(SIGPIPE, SIG_IGN);
+#endif
+        _stream_serv.listen(_stream_port);
+        _stream_port = _stream_serv.port();
+      }
 
-      // Run an RPC at each connection.
-      while (true)
+      // Serve each connection in the background. The scope reaps finished
+      // clients and terminates the remaining ones when the server stops.
+      typedef void (Hermes::*Session)(
+        std::unique_ptr<reactor::network::TCPSocket>);
+      elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
       {
-        reactor::network::TCPSocket* sock = _serv.accept();
+        auto accept = [this, &scope] (reactor::network::TCPServer& server,
+                                      Session session)
+          {
+            while (true)
+            {
+              std::unique_ptr<reactor::network::TCPSocket> socket(
+                server.accept());
+              // Lambdas can't capture by move: share the socket with the
+              // client.
+              auto pending = std::make_shared<
+                std::unique_ptr<reactor::network::TCPSocket>>(
+                  std::move(socket));
+              scope.run_background(
+                elle::sprintf("client %s", pending->get()),
+                [this, pending, session]
+                {
+                  (this->*session)(std::move(*pending));
+                });
+            }
+          };
+        scope.run_background("coalesce", [this] { this->_coalesce(); });
+        if (_stream_port >= 0)
+          scope.run_background(
+            "stream",
+            [this, accept] { accept(this->_stream_serv, &Hermes::_stream); });
+        accept(_serv, &Hermes::_serve);
+      };
+    }
 
-        auto client = [this, sock]
-        {
-          infinit::protocol::Serializer s(_sched, *sock);
-          infinit::protocol::ChanneledStream channels(_sched, s);
+    int
+    Hermes::port() const
+    {
+      return _port;
+    }
+
+    void
+    Hermes::_serve(std::unique_ptr<reactor::network::TCPSocket> socket)
+    {
+      try
+      {
+        infinit::protocol::Serializer s(_sched, *socket);
+        infinit::protocol::ChanneledStream channels(_sched, s);
 
-          HermesRPC rpc(channels);
-          Clerk clerk(_base_path);
+        HermesRPC rpc(channels);
+        TID tid;
+        std::shared_ptr<Clerk> clerk;
+        auto identified = [&] () -> Clerk&
+          {
+            if (clerk == nullptr)
+              throw elle::Exception(
+                "Trying to access a transaction without identifying");
+            return *clerk;
+          };
+
+        rpc.ident = [&] (TID id)
+          {
+            clerk = this->_clerk(id);
+            tid = id;
+          };
+
+        rpc.store = [&] (FileID id, Offset off, elle::Buffer& buff)
+          {
+            return identified().store(id, off, buff);
+          };
+
+        rpc.fetch = [&] (FileID id, Offset off, Size size)
+          {
+            return identified().fetch(id, off, size);
+          };
+
+        // Connections still using the clerk fail their next requests.
+        rpc.remove = [&] ()
+          {
+            identified().remove();
+            this->_forget(tid);
+            clerk.reset();
+          };
+
+        rpc.run();
+      }
+      catch (reactor::Terminate const&)
+      {
+        throw;
+      }
+      catch (std::exception const&)
+      {
+        // A client failure must not take the other clients down with it.
+        ELLE_TRACE("client %s ended: %s",
+                   socket->peer(), elle::exception_string());
+      }
+    }
 
-          rpc.ident = std::bind(&Clerk::ident,
-                                &clerk,
-                                std::placeholders::_1);
+    void
+    Hermes::_stream(std::unique_ptr<reactor::network::TCPSocket> socket)
+    {
+      try
+      {
+        char length;
+        socket->read(reactor::network::Buffer(&length, 1));
+        std::string tid(static_cast<unsigned char>(length), '\0');
+        if (not tid.empty())
+          socket->read(reactor::network::Buffer(&tid[0], tid.size()));
+        std::shared_ptr<Clerk> clerk = this->_clerk(tid);
 
-          rpc.store = std::bind(&Clerk::store,
-                                &clerk,
-                                std::placeholders::_1,
-                                std::placeholders::_2,
-                                std::placeholders::_3);
+        while (true)
+        {
+          char request[24];
+          socket->read(reactor::network::Buffer(request, sizeof(request)));
+          FileID id = decode(request);
+          Offset off = decode(request + 8);
+          Size size = decode(request + 16);
 
-          rpc.fetch = std::bind(&Clerk::fetch,
-                                &clerk,
-                                std::placeholders::_1,
-                                std::placeholders::_2,
-                                std::placeholders::_3);
+          // Hold the block files before yielding: coalescing may remove them
+          // and the clerk may close their cached descriptors meanwhile.
+          std::vector<Extent> extents;
+          std::vector<int> fds;
+          elle::SafeFinally close(
+            [&]
+            {
+              for (int fd: fds)
+                ::close(fd);
+            });
+          char header[9] = {0};
+          try
+          {
+            extents = clerk->locate(id, off, size);
+            for (auto const& extent: extents)
+            {
+              int fd = ::dup(clerk->open(extent));
+              if (fd < 0)
+                throw elle::Exception(
+                  elle::sprintf("IO error: could not open block: %s",
+                                std::strerror(errno)));
+              fds.push_back(fd);
+            }
+          }
+          catch (elle::Exception const&)
+          {
+            ELLE_DEBUG("%s: unable to fetch %s bytes of %s at %s: %s",
+                       tid, size, id, off, elle::exception_string());
+            extents.clear();
+            header[0] = 1;
+          }
+          Size total = 0;
+          for (auto const& extent: extents)
+            total += extent.size;
+          encode(header + 1, total);
+          socket->write(elle::ConstWeakBuffer(header, sizeof(header)));
+          for (std::size_t i = 0; i < extents.size(); ++i)
+            _send(*socket, fds[i], extents[i].offset, extents[i].size);
+          ELLE_DEBUG("%s: sent %s bytes of %s at %s", tid, total, id, off);
+        }
+      }
+      catch (reactor::Terminate const&)
+      {
+        throw;
+      }
+      catch (std::exception const&)
+      {
+        ELLE_TRACE("stream client %s ended: %s",
+                   socket->peer(), elle::exception_string());
+      }
+    }
 
-          rpc.run();
+#ifdef INFINIT_LINUX
+    static
+    void
+    wait_writable(reactor::network::TCPSocket& socket)
+    {
+      auto ready = std::make_shared<reactor::Barrier>(
+        elle::sprintf("%s writable", socket));
+      auto handler = [ready] (boost::system::error_code const& error,
+                              std::size_t)
+        {
+          if (error != boost::asio::error::operation_aborted)
+            ready->open();
         };
+      auto& asio = *socket.socket();
+      asio.async_write_some(boost::asio::null_buffers(), handler);
+      elle::SafeFinally cancel(
+        [&]
+        {
+          if (not ready->opened())
+            asio.cancel();
+        });
+      reactor::wait(*ready);
+    }
 
-        // TODO: Change name of clients.
-        _clients.emplace_back(new reactor::Thread(_sched, "random", client));
+    void
+    Hermes::_send(reactor::network::TCPSocket& socket,
+                  int fd,
+                  Offset off,
+                  Size size)
+    {
+      int out = socket.socket()->native_handle();
+      off_t pos = off;
+      while (size > 0)
+      {
+        ssize_t res = ::sendfile(out, fd, &pos, std::min(size, send_chunk));
+        if (res > 0)
+        {
+          size -= res;
+          continue;
+        }
+        if (res == 0)
+          throw elle::Exception("IO error: block file is truncated");
+        if (errno == EINTR)
+          continue;
+        if (errno == EAGAIN)
+        {
+          wait_writable(socket);
+          continue;
+        }
+        if (errno == ECONNRESET or errno == EPIPE)
+          throw reactor::network::ConnectionClosed();
+        throw reactor::network::Exception(
+          elle::sprintf("sendfile failed: %s", std::strerror(errno)));
+      }
+    }
+#else
+    void
+    Hermes::_send(reactor::network::TCPSocket& socket,
+                  int fd,
+                  Offset off,
+                  Size size)
+    {
+      elle::Buffer buffer(std::min(size, send_chunk));
+      while (size > 0)
+      {
+        ssize_t res = ::pread(fd, buffer.mutable_contents(),
+                              std::min(size, send_chunk), off);
+        if (res < 0 and errno == EINTR)
+          continue;
+        if (res <= 0)
+          throw elle::Exception("IO error: could not read file");
+        socket.write(elle::ConstWeakBuffer(buffer.contents(), res));
+        size -= res;
+        off += res;
+      }
+    }
+#endif
+
+    std::shared_ptr<Clerk>
+    Hermes::_clerk(TID const& id)
+    {
+      auto it = _clerks_index.find(id);
+      if (it != _clerks_index.end())
+      {
+        _clerks.splice(_clerks.begin(), _clerks, it->second);
+        return it->second->second;
+      }
+
+      auto clerk = std::make_shared<Clerk>(_base_path, _descriptors);
+      clerk->ident(id);
+      _clerks.emplace_front(id, clerk);
+      _clerks_index[id] = _clerks.begin();
+      // Forget the least recently used clerks no connection is using.
+      for (auto it = _clerks.rbegin();
+           _clerks.size() > _clerks_max and it != _clerks.rend();)
+        if (it->second.use_count() == 1)
+        {
+          _clerks_index.erase(it->first);
+          it = Clerks::reverse_iterator(_clerks.erase(std::next(it).base()));
+        }
+        else
+          ++it;
+      return clerk;
+    }
+
+    void
+    Hermes::_forget(TID const& id)
+    {
+      auto it = _clerks_index.find(id);
+      if (it == _clerks_index.end())
+        return;
+      _clerks.erase(it->second);
+      _clerks_index.erase(it);
+    }
+
+    void
+    Hermes::_coalesce()
+    {
+      while (true)
+      {
+        reactor::sleep(boost::posix_time::milliseconds(100));
+        Size budget = coalesce_budget;
+        for (auto const& clerk: _clerks)
+        {
+          if (budget == 0)
+            break;
+          budget -= std::min(
+            budget, clerk.second->coalesce(budget, coalesce_budget));
+        }
       }
     }
 
@@ -73,7 +395,39 @@ namespace oracle
                              elle::serialize::OutputBinaryArchive>(channels),
       ident("ident", *this),
       store("store", *this),
-      fetch("fetch", *this)
+      fetch("fetch", *this),
+      remove("remove", *this)
     {}
+
+    HermesStream::HermesStream(reactor::network::TCPSocket& socket,
+                               TID const& id):
+      _socket(socket)
+    {
+      if (id.size() > 255)
+        throw elle::Exception("Transaction ID is too long");
+      std::string header(1, static_cast<char>(id.size()));
+      header += id;
+      _socket.write(elle::ConstWeakBuffer(header.data(), header.size()));
+    }
+
+    elle::Buffer
+    HermesStream::fetch(FileID id, Offset off, Size size)
+    {
+      char request[24];
+      encode(request, id);
+      encode(request + 8, off);
+      encode(request + 16, size);
+      _socket.write(elle::ConstWeakBuffer(request, sizeof(request)));
+
+      char header[9];
+      _socket.read(reactor::network::Buffer(header, sizeof(header)));
+      if (header[0] != 0)
+        throw elle::Exception("Chunk not found");
+      elle::Buffer ret(decode(header + 1));
+      if (ret.size() > 0)
+        _socket.read(reactor::network::Buffer(
+          reinterpret_cast<char*>(ret.mutable_contents()), ret.size()));
+      return ret;
+    }
   }
 }
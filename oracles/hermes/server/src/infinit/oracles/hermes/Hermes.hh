@@ -14,28 +14,84 @@
 
 # include <infinit/oracles/hermes/Clerk.hh>
 
+# include <list>
+# include <memory>
+# include <unordered_map>
+# include <utility>
+
 namespace oracle
 {
   namespace hermes
   {
+    /// Block storage for cloud buffered transactions.
+    ///
+    /// Clients store and fetch blocks through HermesRPC. Fetches can also go
+    /// through the stream port, where block bytes are sent straight from the
+    /// block files: see HermesStream.
     class Hermes
     {
     public:
-      Hermes(reactor::Scheduler& sched, int port, std::string base_path);
+      /// \param stream_port The port serving stream fetches, 0 for any port
+      ///                    and -1 to disable them.
+      Hermes(reactor::Scheduler& sched,
+             int port,
+             std::string base_path,
+             int stream_port = -1);
       ~Hermes();
 
     public:
       void
       run();
 
+      /// The RPC port, once running.
+      int
+      port() const;
+
+    private:
+      /// Serve the RPCs of a connection until it is closed.
+      void
+      _serve(std::unique_ptr<reactor::network::TCPSocket> socket);
+
+      /// Serve the stream fetches of a connection until it is closed.
+      void
+      _stream(std::unique_ptr<reactor::network::TCPSocket> socket);
+
+      /// Send size bytes of fd from off to the socket.
+      static
+      void
+      _send(reactor::network::TCPSocket& socket, int fd, Offset off, Size size);
+
+      /// The clerk of a transaction, shared by all its connections.
+      std::shared_ptr<Clerk>
+      _clerk(TID const& id);
+
+      /// Drop the clerk of a removed transaction.
+      void
+      _forget(TID const& id);
+
+      /// Merge the chunks of cached transactions in the background.
+      void
+      _coalesce();
+
     private:
       reactor::Scheduler& _sched;
       reactor::network::TCPServer _serv;
-      std::vector<reactor::Thread*> _clients;
+      reactor::network::TCPServer _stream_serv;
 
     private:
       boost::filesystem::path _base_path;
       int _port;
+      int _stream_port;
+
+    private:
+      /// Block files open for all clerks, so that the descriptors in use are
+      /// bounded server-wide rather than per transaction.
+      FileCache _descriptors;
+      /// Clerks of recently served transactions, most recent first.
+      typedef std::list<std::pair<TID, std::shared_ptr<Clerk>>> Clerks;
+      Clerks _clerks;
+      std::unordered_map<TID, Clerks::iterator> _clerks_index;
+      std::size_t _clerks_max;
     };
 
     class HermesRPC:
@@ -47,6 +103,26 @@ namespace oracle
       RemoteProcedure<void, TID> ident;
       RemoteProcedure<Size, FileID, Offset, elle::Buffer&> store;
       RemoteProcedure<elle::Buffer, FileID, Offset, Size> fetch;
+      RemoteProcedure<void> remove;
+    };
+
+    /// Client of the Hermes stream port.
+    ///
+    /// The client sends the length of the transaction ID on one byte and the
+    /// ID, then any number of fetch requests: file ID, offset and size as
+    /// 64 bits big endian integers. Each reply is a status byte, zero if the
+    /// bytes were found, followed by the size of the data as a 64 bits big
+    /// endian integer and the data.
+    class HermesStream
+    {
+    public:
+      HermesStream(reactor::network::TCPSocket& socket, TID const& id);
+
+      elle::Buffer
+      fetch(FileID id, Offset off, Size size);
+
+    private:
+      reactor::network::TCPSocket& _socket;
     };
   }
 }
@@ -1,5 +1,7 @@
 #define BOOST_TEST_MODULE Hermes
 
+#include <chrono>
+#include <cstdlib>
 #include <fstream>
 
 #include <boost/filesystem.hpp>
@@ -12,13 +14,14 @@
 static const std::string base_path = std::string("/tmp/hermes");
 static const char* host = "127.0.0.1";
 static const int port = 4242;
+static const int stream_port = 4243;
 
 static
 void
 server()
 {
   auto& sched = *reactor::Scheduler::scheduler();
-  oracle::hermes::Hermes(sched, port, base_path).run();
+  oracle::hermes::Hermes(sched, port, base_path, stream_port).run();
 };
 
 static
@@ -42,6 +45,22 @@ test_content(std::string msg, std::string tid, uint64_t id, uint64_t off)
   return result;
 }
 
+// Blocks stored in front of others are kept in their own file: check the
+// content through the server.
+static
+bool
+fetch_content(oracle::hermes::HermesRPC& handler,
+              std::string msg,
+              uint64_t id,
+              uint64_t off)
+{
+  elle::Buffer output(handler.fetch(id, off, msg.size()));
+  std::string content(reinterpret_cast<char const*>(output.contents()),
+                      output.size());
+  std::cout << msg << ":" << content << std::endl;
+  return content == msg;
+}
+
 BOOST_AUTO_TEST_CASE(append)
 {
   reactor::Scheduler sched;
@@ -162,13 +181,13 @@ BOOST_AUTO_TEST_CASE(prepend)
       std::string msg2("This is");
       elle::Buffer input2(msg2.c_str(), msg2.size());
       BOOST_CHECK_EQUAL(handler.store(1, 12, input2), input2.size());
-      BOOST_CHECK(test_content(msg2 + msg1, tid3, 1, 12));
+      BOOST_CHECK(fetch_content(handler, msg2 + msg1, 1, 12));
 
       // Preprend anoter message.
       std::string msg3("My message: ");
       elle::Buffer input3(msg3.c_str(), msg3.size());
       BOOST_CHECK_EQUAL(handler.store(1, 0, input3), input3.size());
-      BOOST_CHECK(test_content(msg3 + msg2 + msg1, tid3, 1, 0));
+      BOOST_CHECK(fetch_content(handler, msg3 + msg2 + msg1, 1, 0));
     }
 
     serv->terminate_now();
@@ -231,7 +250,7 @@ BOOST_AUTO_TEST_CASE(mix)
       std::string msg5("This ");
       elle::Buffer input5(msg5.c_str(), msg5.size());
       BOOST_CHECK_EQUAL(handler.store(0, 0, input5), input5.size());
-      BOOST_CHECK(test_content(msg5 + msg1 + "is pretty " + msg4, tid, 0, 0));
+      BOOST_CHECK(fetch_content(handler, msg5 + msg1 + "is pretty " + msg4, 0, 0));
     }
 
     serv->terminate_now();
@@ -371,7 +390,7 @@ BOOST_AUTO_TEST_CASE(fail_fetch)
   sched.run();
 }
 
-BOOST_AUTO_TEST_CASE(fail_store)
+BOOST_AUTO_TEST_CASE(duplicate_store)
 {
   reactor::Scheduler sched;
 
@@ -395,9 +414,10 @@ BOOST_AUTO_TEST_CASE(fail_store)
       BOOST_CHECK_EQUAL(handler.store(0, 0, input1), input1.size());
       BOOST_CHECK(test_content(msg1, tid, 0, 0));
 
-      // Try to store the message once again with the same id.
+      // Store the message once again with the same id, as a retrying
+      // uploader would.
       elle::Buffer input2(msg1.c_str(), msg1.size());
-      BOOST_CHECK_THROW(handler.store(0, 0, input1), elle::Exception);
+      BOOST_CHECK_EQUAL(handler.store(0, 0, input2), input2.size());
       BOOST_CHECK(test_content(msg1, tid, 0, 0));
     }
 
@@ -410,6 +430,106 @@ BOOST_AUTO_TEST_CASE(fail_store)
   sched.run();
 }
 
+BOOST_AUTO_TEST_CASE(short_sessions)
+{
+  reactor::Scheduler sched;
+
+  oracle::hermes::TID tid("transaction10");
+  std::string const msg("By the Power of Grayskull");
+
+  auto client = [=] (reactor::Thread* serv)
+  {
+    auto& sched = *reactor::Scheduler::scheduler();
+
+    // Store each byte from its own connection, sharing the same clerk.
+    for (uint64_t i = 0; i < msg.size(); ++i)
+    {
+      reactor::network::TCPSocket socket(sched, host, port);
+      infinit::protocol::Serializer s(sched, socket);
+      infinit::protocol::ChanneledStream channels(sched, s);
+
+      oracle::hermes::HermesRPC handler(channels);
+      handler.ident(tid);
+
+      elle::Buffer input(msg.c_str() + i, 1);
+      BOOST_CHECK_EQUAL(handler.store(0, i, input), 1);
+    }
+
+    {
+      reactor::network::TCPSocket socket(sched, host, port);
+      infinit::protocol::Serializer s(sched, socket);
+      infinit::protocol::ChanneledStream channels(sched, s);
+
+      oracle::hermes::HermesRPC handler(channels);
+      handler.ident(tid);
+      BOOST_CHECK(fetch_content(handler, msg, 0, 0));
+    }
+
+    serv->terminate_now();
+  };
+
+  reactor::Thread serv(sched, "hermes", server);
+  reactor::Thread cli(sched, "client", std::bind(client, &serv));
+
+  sched.run();
+}
+
+// Fetch through the stream port, across chunks and out of them.
+BOOST_AUTO_TEST_CASE(stream_fetch)
+{
+  reactor::Scheduler sched;
+
+  oracle::hermes::TID tid("transaction11");
+  std::string const msg("By the Power of Grayskull, I have the power!");
+
+  auto client = [=] (reactor::Thread* serv)
+  {
+    auto& sched = *reactor::Scheduler::scheduler();
+
+    {
+      reactor::network::TCPSocket socket(sched, host, port);
+      infinit::protocol::Serializer s(sched, socket);
+      infinit::protocol::ChanneledStream channels(sched, s);
+
+      oracle::hermes::HermesRPC handler(channels);
+      handler.ident(tid);
+
+      // Store the message in two chunks, the second one first.
+      elle::Buffer second(msg.c_str() + 10, msg.size() - 10);
+      BOOST_CHECK_EQUAL(handler.store(0, 10, second), msg.size() - 10);
+      elle::Buffer first(msg.c_str(), 10);
+      BOOST_CHECK_EQUAL(handler.store(0, 0, first), 10);
+    }
+
+    {
+      reactor::network::TCPSocket socket(sched, host, stream_port);
+      oracle::hermes::HermesStream stream(socket, tid);
+      auto check = [&] (uint64_t off, uint64_t size)
+        {
+          elle::Buffer output(stream.fetch(0, off, size));
+          std::string content(reinterpret_cast<char const*>(output.contents()),
+                              output.size());
+          BOOST_CHECK_EQUAL(content, msg.substr(off, size));
+        };
+      check(0, msg.size());
+      check(5, 10);
+      check(12, 3);
+      // Reading past the end stops at the last stored byte.
+      check(20, 1000);
+      BOOST_CHECK_THROW(stream.fetch(1, 0, 10), elle::Exception);
+      // The connection survives failed fetches.
+      check(0, 10);
+    }
+
+    serv->terminate_now();
+  };
+
+  reactor::Thread serv(sched, "hermes", server);
+  reactor::Thread cli(sched, "client", std::bind(client, &serv));
+
+  sched.run();
+}
+
 BOOST_AUTO_TEST_CASE(fail_boot)
 {
   reactor::Scheduler sched;
@@ -426,3 +546,133 @@ BOOST_AUTO_TEST_CASE(fail_boot)
   reactor::Thread serv(sched, "hermes", serv2);
   sched.run();
 }
+
+// Store a transaction in 256 KiB blocks, every other block first so the file
+// is scattered over many chunks, and fetch it back. Set HERMES_BENCH_SIZE to
+// the size in MiB to benchmark larger transactions.
+BOOST_AUTO_TEST_CASE(bench_store_fetch)
+{
+  char const* env = ::getenv("HERMES_BENCH_SIZE");
+  uint64_t const total = (env ? std::stoull(env) : 64) * 1024 * 1024;
+  uint64_t const block = 256 * 1024;
+  uint64_t const count = total / block;
+
+  boost::filesystem::path path(base_path);
+  oracle::hermes::Clerk::check_directory(path);
+  boost::filesystem::remove_all(path / "bench");
+  oracle::hermes::FileCache descriptors;
+  oracle::hermes::Clerk clerk(path, descriptors);
+  clerk.ident("bench");
+
+  elle::Buffer data(block);
+  for (uint64_t i = 0; i < block; ++i)
+    data.mutable_contents()[i] = i % 251;
+
+  auto start = std::chrono::steady_clock::now();
+  auto elapsed = [&]
+    {
+      auto now = std::chrono::steady_clock::now();
+      auto res = std::chrono::duration<double>(now - start).count();
+      start = now;
+      return res;
+    };
+  for (uint64_t pass = 0; pass < 2; ++pass)
+    for (uint64_t i = pass; i < count; i += 2)
+      BOOST_CHECK_EQUAL(clerk.store(0, i * block, data), block);
+  std::cout << "store " << count << " blocks: " << elapsed() << "s"
+            << std::endl;
+  for (uint64_t i = 0; i < count; ++i)
+  {
+    elle::Buffer output(clerk.fetch(0, i * block, block));
+    BOOST_CHECK_EQUAL(output.size(), block);
+  }
+  std::cout << "fetch " << count << " blocks: " << elapsed() << "s"
+            << std::endl;
+  boost::filesystem::remove_all(path / "bench");
+}
+
+// Store overlapping blocks in any order, fetch the whole range and merge the
+// chunks.
+BOOST_AUTO_TEST_CASE(out_of_order)
+{
+  boost::filesystem::path path(base_path);
+  oracle::hermes::Clerk::check_directory(path);
+  boost::filesystem::remove_all(path / "out_of_order");
+  oracle::hermes::FileCache descriptors;
+  oracle::hermes::Clerk clerk(path, descriptors);
+  clerk.ident("out_of_order");
+
+  std::string const msg("By the Power of Grayskull, I have the power!");
+  auto store = [&] (uint64_t off, uint64_t size)
+    {
+      elle::Buffer input(msg.c_str() + off, size);
+      BOOST_CHECK_EQUAL(clerk.store(0, off, input), size);
+    };
+  store(30, 14);
+  store(10, 10);
+  store(15, 20);
+  store(0, 12);
+  auto content = [&]
+    {
+      elle::Buffer output(clerk.fetch(0, 0, msg.size()));
+      return std::string(reinterpret_cast<char const*>(output.contents()),
+                         output.size());
+    };
+  BOOST_CHECK_EQUAL(content(), msg);
+  // Chunks the budget left can't cover are merged in a later round.
+  BOOST_CHECK_EQUAL(clerk.coalesce(5, 1024), 0);
+  BOOST_CHECK_EQUAL(clerk.coalesce(1024, 1024), msg.size() - 10);
+  BOOST_CHECK_EQUAL(clerk.coalesce(1024, 1024), 0);
+  BOOST_CHECK(test_content(msg, "out_of_order", 0, 0));
+  BOOST_CHECK_EQUAL(content(), msg);
+  boost::filesystem::remove_all(path / "out_of_order");
+}
+
+// Removing a transaction deletes its blocks, connections still using it fail.
+BOOST_AUTO_TEST_CASE(remove)
+{
+  reactor::Scheduler sched;
+
+  oracle::hermes::TID tid("transaction12");
+  std::string msg("content");
+
+  auto client = [=] (reactor::Thread* serv)
+  {
+    auto& sched = *reactor::Scheduler::scheduler();
+
+    {
+      reactor::network::TCPSocket socket1(sched, host, port);
+      infinit::protocol::Serializer s1(sched, socket1);
+      infinit::protocol::ChanneledStream channels1(sched, s1);
+      oracle::hermes::HermesRPC handler1(channels1);
+      handler1.ident(tid);
+
+      reactor::network::TCPSocket socket2(sched, host, port);
+      infinit::protocol::Serializer s2(sched, socket2);
+      infinit::protocol::ChanneledStream channels2(sched, s2);
+      oracle::hermes::HermesRPC handler2(channels2);
+      handler2.ident(tid);
+
+      elle::Buffer input(msg.c_str(), msg.size());
+      BOOST_CHECK_EQUAL(handler1.store(0, 0, input), input.size());
+      BOOST_CHECK(test_content(msg, tid, 0, 0));
+
+      handler1.remove();
+      BOOST_CHECK(!boost::filesystem::exists(base_path + "/" + tid));
+      BOOST_CHECK_THROW(handler1.fetch(0, 0, msg.size()), elle::Exception);
+      BOOST_CHECK_THROW(handler2.fetch(0, 0, msg.size()), elle::Exception);
+
+      // The transaction starts over when identified again.
+      handler1.ident(tid);
+      BOOST_CHECK_THROW(handler1.fetch(0, 0, msg.size()), elle::Exception);
+      handler1.remove();
+    }
+
+    serv->terminate_now();
+  };
+
+  reactor::Thread serv(sched, "hermes", server);
+  reactor::Thread cli(sched, "client", std::bind(client, &serv));
+
+  sched.run();
+}
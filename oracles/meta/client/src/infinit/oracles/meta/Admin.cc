@@ -131,7 +131,7 @@ namespace infinit
 
       void
       Admin::apertus_update_bandwidth(boost::uuids::uuid const& uid,
-                                      uint32_t bandwidth,
+                                      uint64_t bandwidth,
                                       uint32_t number_of_transfers)
       {
         std::string const url = sprintf("/apertus/%s/bandwidth", uid);
@@ -141,7 +141,7 @@ namespace infinit
           [&] (reactor::http::Request& request)
           {
             elle::serialization::json::SerializerOut output(request, false);
-            int bandwidth_ = bandwidth;
+            int64_t bandwidth_ = bandwidth;
             output.serialize("bandwidth", bandwidth_);
             int number = number_of_transfers;
             output.serialize("number_of_transfers", number);
@@ -59,7 +59,7 @@ namespace infinit
 
         void
         apertus_update_bandwidth(boost::uuids::uuid const& uid,
-                                 uint32_t bandwidth,
+                                 uint64_t bandwidth,
                                  uint32_t number_of_transfers);
 
         void
@@ -5,7 +5,6 @@
 #include <cryptography/oneway.hh>
 
 #include <papier/Authority.hh>
-#include <boost/functional/hash.hpp>
 #include <papier/Passport.hh>
 
 namespace papier
@@ -87,12 +86,7 @@ namespace papier
   bool
   Passport::operator ==(Passport const& passport) const
   {
-    elle::io::Unique theirs;
-    elle::io::Unique ours;
-
-    this->Save(ours);
-    passport.Save(theirs);
-    return ours == theirs;
+    return this->digest() == passport.digest();
   }
 
   bool
@@ -100,6 +94,20 @@ namespace papier
   {
     return !(*this == passport);
   }
+
+  std::string const&
+  Passport::digest() const
+  {
+    if (this->_digest.empty())
+    {
+      auto digest = infinit::cryptography::oneway::hash(
+        *this, infinit::cryptography::oneway::Algorithm::sha1);
+      this->_digest.assign(
+        reinterpret_cast<char const*>(digest.buffer().contents()),
+        digest.buffer().size());
+    }
+    return this->_digest;
+  }
 }
 
 namespace std
@@ -107,14 +115,6 @@ namespace std
   std::size_t
   hash<papier::Passport>::operator()(papier::Passport const& s) const
   {
-    // XXX: The id is definitely not unique.
-    auto id = std::hash<std::string>()(s.id());
-    auto k = std::hash<elle::ConstWeakBuffer>()(
-      infinit::cryptography::oneway::hash(
-        s.owner_K(), infinit::cryptography::oneway::Algorithm::sha1).buffer());
-    size_t seed = 0;
-    boost::hash_combine(seed, id);
-    boost::hash_combine(seed, k);
-    return seed;
+    return std::hash<std::string>()(s.digest());
   }
 }
@@ -31,6 +31,9 @@ namespace papier
     ELLE_ATTRIBUTE_R(elle::String, name);
     ELLE_ATTRIBUTE_R(cryptography::PublicKey, owner_K);
     cryptography::Signature _signature;
+    /// Digest of the whole passport, computed on first use by hashing and
+    /// comparison. Empty until then.
+    mutable std::string _digest;
 
     /*-------------.
     | Construction |
@@ -68,6 +71,10 @@ namespace papier
 
     bool operator < (Passport const&) const;
 
+    /// The cached digest of the passport.
+    std::string const&
+    digest() const;
+
   private:
     ELLE_SERIALIZE_FRIEND_FOR(Passport);
   };
@@ -12,6 +12,8 @@ ELLE_SERIALIZE_SIMPLE(papier::Passport,
   archive & value._name;
   archive & value._owner_K;
   archive & value._signature;
+  if (archive.mode == ArchiveMode::input)
+    value._digest.clear();
 }
 
 #endif
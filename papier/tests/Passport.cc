@@ -1,9 +1,18 @@
+#include <unordered_set>
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+
+#include <elle/log.hh>
+#include <elle/serialize/extract.hh>
+#include <elle/serialize/insert.hh>
 #include <elle/test.hh>
 
 #include <cryptography/KeyPair.hh>
 
 #include <papier/Passport.hh>
 
+ELLE_LOG_COMPONENT("papier.test");
+
 class KeyPair:
   public infinit::cryptography::KeyPair
 {
@@ -68,9 +77,56 @@ ordering()
   BOOST_CHECK((p12 < p21) != (p21 < p12));
 }
 
+static
+void
+equality()
+{
+  KeyPair keys;
+  papier::Passport p1("device_id_1", "device_name_1", keys.K(), authority);
+  papier::Passport p2("device_id_2", "device_name_2", keys.K(), authority);
+  papier::Passport copy(p1);
+  BOOST_CHECK_EQUAL(p1, copy);
+  BOOST_CHECK_NE(p1, p2);
+  BOOST_CHECK_EQUAL(p1.digest(), copy.digest());
+  // Deserializing over a passport drops its cached digest.
+  BOOST_CHECK_NE(p1.digest(), p2.digest());
+  std::string serialized;
+  elle::serialize::to_string(serialized) << p2;
+  elle::serialize::from_string(serialized) >> p1;
+  BOOST_CHECK_EQUAL(p1, p2);
+  BOOST_CHECK_EQUAL(std::hash<papier::Passport>()(p1),
+                    std::hash<papier::Passport>()(p2));
+}
+
+// Lookup cost in a set of hosts, as done by stations on every handshake.
+static
+void
+lookup()
+{
+  unsigned const count = 256;
+  int const rounds = 16;
+  KeyPair keys;
+  std::vector<papier::Passport> passports;
+  for (unsigned i = 0; i < count; ++i)
+    passports.emplace_back(elle::sprintf("device_id_%s", i),
+                           elle::sprintf("device_name_%s", i),
+                           keys.K(), authority);
+  std::unordered_set<papier::Passport> hosts(passports.begin(),
+                                             passports.end());
+  BOOST_CHECK_EQUAL(hosts.size(), count);
+  auto start = boost::posix_time::microsec_clock::local_time();
+  for (int r = 0; r < rounds; ++r)
+    for (auto const& passport: passports)
+      BOOST_CHECK(hosts.find(passport) != hosts.end());
+  auto elapsed = boost::posix_time::microsec_clock::local_time() - start;
+  ELLE_LOG("%s lookups among %s hosts in %s", count * rounds, count, elapsed);
+}
+
 ELLE_TEST_SUITE()
 {
   auto& suite = boost::unit_test::framework::master_test_suite();
   suite.add(BOOST_TEST_CASE(hash), 0, 10);
   suite.add(BOOST_TEST_CASE(ordering), 0, 10);
+  suite.add(BOOST_TEST_CASE(equality), 0, 10);
+  suite.add(BOOST_TEST_CASE(lookup), 0, 60);
 }
@@ -5,14 +5,19 @@ namespace station
 {
   Host::Host(Station& owner,
              papier::Passport const& passport,
+             std::string const& id,
              std::unique_ptr<reactor::network::Socket>&& socket):
     _owner(&owner),
     _passport(passport),
+    _id(id),
+    _resumed(false),
     _socket(std::move(socket))
   {}
 
   Host::Host(std::unique_ptr<reactor::network::Socket>&& socket):
     _owner(nullptr),
+    _id(),
+    _resumed(false),
     _socket(std::move(socket))
   {}
 
@@ -20,7 +25,9 @@ namespace station
   {
     if (this->_owner)
     {
-      ELLE_ASSERT_CONTAINS(this->_owner->_hosts, this->passport());
+      ELLE_ASSERT(this->_owner->_hosts.find(
+                    std::make_pair(this->passport(), this->id())) !=
+                  this->_owner->_hosts.end());
       this->_owner->_host_remove(*this);
     }
   }
@@ -36,6 +43,9 @@ namespace station
   void
   Host::print(std::ostream& stream) const
   {
-    stream << "Host(" << this->passport() << ")";
+    stream << "Host(" << this->passport();
+    if (!this->_id.empty())
+      stream << ", " << this->_id;
+    stream << ")";
   }
 }
@@ -27,10 +27,15 @@ namespace station
     friend class Station;
     Host(Station& owner,
          papier::Passport const& passport,
+         std::string const& id,
          std::unique_ptr<reactor::network::Socket>&& socket);
 
     ELLE_ATTRIBUTE(Station*, owner);
     ELLE_ATTRIBUTE_R(papier::Passport, passport);
+    /// The transfer this connection was negotiated for.
+    ELLE_ATTRIBUTE_R(std::string, id);
+    /// Whether this connection resumed a previous session.
+    ELLE_ATTRIBUTE_R(bool, resumed);
     ELLE_ATTRIBUTE(std::unique_ptr<reactor::network::Socket>, socket);
 
   public:
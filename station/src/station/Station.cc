@@ -1,8 +1,18 @@
+#include <algorithm>
+#include <iomanip>
+#include <random>
+#include <sstream>
+
+#include <boost/functional/hash.hpp>
+
 #include <elle/Exception.hh>
+#include <elle/With.hh>
 #include <elle/log.hh>
 #include <elle/memory.hh>
 #include <elle/finally.hh>
 
+#include <reactor/Scope.hh>
+#include <reactor/TimeoutGuard.hh>
 #include <reactor/scheduler.hh>
 
 #include <station/AlreadyConnected.hh>
@@ -21,21 +31,24 @@ namespace station
   Station::Station(papier::Authority const& authority,
                    papier::Passport const& passport,
                    std::string const& name):
+    _sessions_max(1024),
     _authority(authority),
     _passport(passport),
     _name(name),
     _server(true),
     _server_thread(*reactor::Scheduler::scheduler(),
                    elle::sprintf("%s server thread", *this),
-                   [this] { this->_serve(); })
+                   [this] { this->_serve(); }),
+    _handshake_timeout(10_sec),
+    _handshake_max(64),
+    _handshakes(0)
   {
     this->_server.listen();
   }
 
   Station::~Station() noexcept(false)
   {
-    while (!this->_host_new.empty())
-      this->_host_new.pop();
+    this->_host_new.clear();
     ELLE_ASSERT(this->_hosts.empty());
     this->_server_thread.terminate_now();
   }
@@ -44,12 +57,67 @@ namespace station
   | Hosts |
   `------*/
 
+  std::size_t
+  Station::HostKeyHash::operator ()(HostKey const& key) const
+  {
+    std::size_t res = std::hash<papier::Passport>()(key.first);
+    boost::hash_combine(res, std::hash<std::string>()(key.second));
+    return res;
+  }
+
   void
   Station::_host_remove(Host const& host)
   {
     ELLE_TRACE_SCOPE("%s: remove host %s", *this, host);
-    ELLE_ASSERT_CONTAINS(this->_hosts, host.passport());
-    this->_hosts.erase(host.passport());
+    auto key = std::make_pair(host.passport(), host.id());
+    ELLE_ASSERT(this->_hosts.find(key) != this->_hosts.end());
+    this->_hosts.erase(key);
+  }
+
+  /*---------.
+  | Sessions |
+  `---------*/
+
+  static
+  std::string
+  session_token_generate()
+  {
+    static std::random_device device;
+    std::stringstream res;
+    res << std::hex << std::setfill('0');
+    for (int i = 0; i < 4; ++i)
+      res << std::setw(8) << static_cast<uint32_t>(device());
+    return res.str();
+  }
+
+  void
+  Station::_session_register(HostKey const& key, std::string const& token)
+  {
+    ELLE_DEBUG("%s: register session for transfer %s", *this, key.second);
+    this->_session_forget(key.second);
+    this->_session_tokens[key.second] = token;
+    this->_sessions[token] = key;
+    this->_session_order.push_back(token);
+    // Forget the oldest sessions, their transfers are likely long gone.
+    while (this->_session_order.size() >
+           static_cast<unsigned>(std::max(this->_sessions_max, 0)))
+    {
+      auto oldest = this->_sessions.find(this->_session_order.front());
+      ELLE_ASSERT(oldest != this->_sessions.end());
+      this->_session_forget(oldest->second.second);
+    }
+  }
+
+  void
+  Station::_session_forget(std::string const& id)
+  {
+    auto it = this->_session_tokens.find(id);
+    if (it == this->_session_tokens.end())
+      return;
+    ELLE_DEBUG("%s: forget session for transfer %s", *this, id);
+    this->_sessions.erase(it->second);
+    this->_session_order.remove(it->second);
+    this->_session_tokens.erase(it);
   }
 
   /*-----------.
@@ -57,11 +125,12 @@ namespace station
   `-----------*/
 
   std::unique_ptr<Host>
-  Station::connect(std::string const& host, int port)
+  Station::connect(std::string const& host, int port, std::string const& id)
   {
     ELLE_TRACE_SCOPE("%s: connect to %s:%s", *this, host, port);
     auto socket = elle::make_unique<reactor::network::TCPSocket>(host, port);
-    std::unique_ptr<Host> res = this->_negotiate(std::move(socket));
+    std::unique_ptr<Host> res =
+      this->_negotiate(std::move(socket), id, true);
     ELLE_TRACE("%s: connect succeeded with %s", *this, host);
     return res;
   }
@@ -77,66 +146,148 @@ namespace station
   }
 
   std::unique_ptr<Host>
-  Station::accept()
+  Station::accept(std::string const& id)
   {
-    reactor::Scheduler::scheduler()->current()->wait(this->_host_available);
-    ELLE_ASSERT(!this->_host_new.empty());
-    std::unique_ptr<Host> res = std::move(this->_host_new.front());
-    this->_host_new.pop();
+    ++this->_accepting[id];
+    elle::SafeFinally unregister([&]
+      {
+        if (--this->_accepting[id] == 0)
+          this->_accepting.erase(id);
+        // Hosts without transfer id may now have a single taker.
+        this->_host_arrived.signal();
+      });
+    while (true)
+    {
+      // Hosts without transfer id could be for any waiting transfer: only
+      // hand them over when there's no ambiguity.
+      bool anonymous = this->_accepting.size() == 1;
+      auto it = std::find_if(
+        this->_host_new.begin(), this->_host_new.end(),
+        [&] (std::unique_ptr<Host> const& host)
+        {
+          return host->id() == id || (anonymous && host->id().empty());
+        });
+      if (it != this->_host_new.end())
+      {
+        std::unique_ptr<Host> res = std::move(*it);
+        this->_host_new.erase(it);
+        if (this->_host_new.empty())
+          this->_host_available.close();
+        return res;
+      }
+      reactor::Scheduler::scheduler()->current()->wait(this->_host_arrived);
+    }
+  }
+
+  void
+  Station::forget(std::string const& id)
+  {
+    ELLE_TRACE_SCOPE("%s: forget transfer %s", *this, id);
+    this->_session_forget(id);
+    this->_host_new.remove_if(
+      [&] (std::unique_ptr<Host> const& host)
+      {
+        return host->id() == id;
+      });
     if (this->_host_new.empty())
       this->_host_available.close();
-    return res;
   }
 
   void
   Station::_serve()
   {
-    while (true)
+    elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
     {
-      std::unique_ptr<reactor::network::Socket> socket;
-      try
-      {
-        socket = this->_server.accept();
-      }
-      // https://app.asana.com/0/5058254180090/14728698282583
-      catch (reactor::Terminate const&)
-      {
-        throw;
-      }
-      catch (...)
-      {
-        ELLE_ERR("%s: fatal error accepting host: %s",
-                 *this, elle::exception_string());
-        throw;
-      }
-      ELLE_TRACE_SCOPE("%s: accept connection from %s", *this, socket->peer());
-      try
+      while (true)
       {
-        auto host = _negotiate(std::move(socket));
-        ELLE_DEBUG("%s: accept negotiation with %s", *this, *host);
-        this->_host_new.push(std::move(host));
-        this->_host_available.open();
-      }
-      catch (ConnectionFailure const& e)
-      {
-        ELLE_TRACE("%s: host was rejected: %s", *this, e.what());
-      }
-      catch (std::runtime_error const& e)
-      {
-        ELLE_ERR("%s: host was rejected because of unexpected exception: %s",
-                 *this, e.what());
-      }
-      // https://app.asana.com/0/5058254180090/14728698282583
-      catch (reactor::Terminate const&)
-      {
-        throw;
+        // Bound the number of pending handshakes: don't accept more
+        // connections than we are willing to negotiate.
+        while (this->_handshakes >= this->_handshake_max)
+        {
+          ELLE_DEBUG("%s: %s handshakes in progress, wait",
+                     *this, this->_handshakes);
+          reactor::Scheduler::scheduler()->current()->wait(
+            this->_handshake_ended);
+        }
+        std::unique_ptr<reactor::network::Socket> socket;
+        try
+        {
+          socket = this->_server.accept();
+        }
+        // https://app.asana.com/0/5058254180090/14728698282583
+        catch (reactor::Terminate const&)
+        {
+          throw;
+        }
+        catch (...)
+        {
+          ELLE_ERR("%s: fatal error accepting host: %s",
+                   *this, elle::exception_string());
+          throw;
+        }
+        ELLE_TRACE("%s: accept connection from %s", *this, socket->peer());
+        ++this->_handshakes;
+        // Lambdas can't capture by move: share the socket with the handshake
+        // thread, which takes its ownership.
+        auto pending =
+          std::make_shared<std::unique_ptr<reactor::network::Socket>>(
+            std::move(socket));
+        scope.run_background(
+          elle::sprintf("%s handshake", *this),
+          [this, pending]
+          {
+            elle::SafeFinally ended([this]
+                                    {
+                                      --this->_handshakes;
+                                      this->_handshake_ended.signal();
+                                    });
+            this->_handshake(std::move(*pending));
+          });
       }
-      catch (...)
+    };
+  }
+
+  void
+  Station::_handshake(std::unique_ptr<reactor::network::Socket> socket)
+  {
+    ELLE_TRACE_SCOPE("%s: negotiate connection from %s",
+                     *this, socket->peer());
+    try
+    {
+      std::unique_ptr<Host> host;
       {
-        ELLE_ERR("%s: fatal error negotiating host: %s",
-                 *this, elle::exception_string());
-        throw;
+        reactor::TimeoutGuard guard(this->_handshake_timeout);
+        host = _negotiate(std::move(socket));
       }
+      ELLE_DEBUG("%s: accept negotiation with %s", *this, *host);
+      this->_host_new.push_back(std::move(host));
+      this->_host_available.open();
+      this->_host_arrived.signal();
+    }
+    catch (reactor::Timeout const&)
+    {
+      ELLE_TRACE("%s: host was rejected: handshake timed out after %s",
+                 *this, this->_handshake_timeout);
+    }
+    catch (ConnectionFailure const& e)
+    {
+      ELLE_TRACE("%s: host was rejected: %s", *this, e.what());
+    }
+    catch (std::runtime_error const& e)
+    {
+      ELLE_ERR("%s: host was rejected because of unexpected exception: %s",
+               *this, e.what());
+    }
+    // https://app.asana.com/0/5058254180090/14728698282583
+    catch (reactor::Terminate const&)
+    {
+      throw;
+    }
+    catch (...)
+    {
+      ELLE_ERR("%s: fatal error negotiating host: %s",
+               *this, elle::exception_string());
+      throw;
     }
   }
 
@@ -148,20 +299,146 @@ namespace station
   };
 
   std::unique_ptr<Host>
-  Station::_negotiate(std::unique_ptr<reactor::network::Socket> socket)
+  Station::_negotiate(std::unique_ptr<reactor::network::Socket> socket,
+                      boost::optional<std::string> const& id,
+                      bool resume)
   {
     ELLE_TRACE_SCOPE("%s: negotiate connection with %s",
                      *this, socket->peer());
-    // Exchange protocol version.
-    char version = 0;
+    // Exchange protocol version. Version 1 adds transfer routing, version 2
+    // session resumption.
+    char version = 2;
     socket->write(elle::ConstWeakBuffer(&version, 1));
     auto remote_protocol = socket->read(1)[0];
-    (void)remote_protocol;
     try
     {
       elle::serialize::OutputBinaryArchive output(*socket);
       elle::serialize::InputBinaryArchive input(*socket);
 
+      // Exchange resumption tokens: the connecting side sends the token of
+      // the last session of its transfer, if any, and the other side accepts
+      // it if it knows it.
+      if (remote_protocol >= 2)
+      {
+        // Like full negotiations, hold the host key while resuming so no
+        // other negotiation for it runs concurrently.
+        boost::optional<HostKey> resuming;
+        auto resuming_release = [&]
+          {
+            if (!resuming)
+              return;
+            this->_host_negotiating.erase(resuming.get());
+            this->_negotiation_ended.signal();
+            resuming.reset();
+          };
+        elle::SafeFinally pop_resuming(resuming_release);
+        auto available = [&] (HostKey const& key)
+          {
+            return
+              this->_hosts.find(key) == this->_hosts.end() &&
+              this->_host_negotiating.find(key) ==
+              this->_host_negotiating.end();
+          };
+        // Resumed hosts are registered once the status was exchanged, a
+        // slave full negotiation may have won in between.
+        auto resumed = [&] (HostKey const& key) -> std::unique_ptr<Host>
+          {
+            if (this->_hosts.find(key) != this->_hosts.end())
+            {
+              ELLE_ERR("%s: station conflict on resumed session", *this);
+              throw ConnectionFailure(
+                elle::sprintf("%s: conflict on %s", *this, key.first));
+            }
+            ELLE_LOG("%s: resume session with %s", *this, key.first);
+            std::unique_ptr<Host> res(
+              new Host(*this, key.first, key.second, std::move(socket)));
+            res->_resumed = true;
+            this->_hosts[key] = res.get();
+            return res;
+          };
+        std::string token;
+        if (resume && id)
+        {
+          auto it = this->_session_tokens.find(id.get());
+          if (it != this->_session_tokens.end())
+          {
+            auto const& key = this->_sessions.at(it->second);
+            if (available(key))
+            {
+              token = it->second;
+              resuming = key;
+              this->_host_negotiating.insert(key);
+            }
+          }
+        }
+        output << token;
+        socket->flush();
+        std::string remote_token;
+        input >> remote_token;
+        if (!remote_token.empty())
+        {
+          auto it = this->_sessions.find(remote_token);
+          if (it == this->_sessions.end())
+          {
+            ELLE_DEBUG("%s: unknown session, negotiate", *this);
+            output << NegotiationStatus::invalid;
+            socket->flush();
+          }
+          else
+          {
+            // Copy the key: the session may be replaced while we yield.
+            auto key = it->second;
+            auto connected = [&]
+              {
+                return this->_hosts.find(key) != this->_hosts.end();
+              };
+            // Both ends may resume the session towards each other at once.
+            // Like full negotiations, the master waits for its own attempt to
+            // settle while the slave yields to the master's.
+            bool master = this->passport() < key.first;
+            if (master)
+              while (!connected() && !available(key))
+              {
+                ELLE_DEBUG("%s: session is being negotiated, wait", *this);
+                reactor::Scheduler::scheduler()->current()->wait(
+                  this->_negotiation_ended);
+              }
+            if (connected())
+            {
+              ELLE_TRACE("%s: session is already connected, reject", *this);
+              output << NegotiationStatus::already_connected;
+              socket->flush();
+              throw AlreadyConnected();
+            }
+            if (!available(key))
+              ELLE_DEBUG("%s: session is also being resumed by us, yield",
+                         *this);
+            resuming = key;
+            this->_host_negotiating.insert(key);
+            output << NegotiationStatus::succeeded;
+            socket->flush();
+            return resumed(key);
+          }
+        }
+        if (!token.empty())
+        {
+          NegotiationStatus status;
+          input >> status;
+          switch (status)
+          {
+            case NegotiationStatus::succeeded:
+              return resumed(resuming.get());
+            case NegotiationStatus::already_connected:
+              ELLE_TRACE("%s: peer says session is already connected", *this);
+              throw AlreadyConnected();
+            default:
+              ELLE_DEBUG("%s: peer doesn't know our session, negotiate",
+                         *this);
+          }
+        }
+        resuming_release();
+      }
+
       // Exchange passports.
       ELLE_DEBUG("%s: send pasport", *this)
       {
@@ -176,10 +453,24 @@ namespace station
       ELLE_DEBUG("%s: peer authenticates with %s", *this, remote);
       ELLE_ASSERT_NEQ(remote, this->passport());
 
+      // Exchange the transfer id: the connecting side knows it.
+      std::string transfer = id ? id.get() : "";
+      if (remote_protocol >= 1)
+      {
+        output << transfer;
+        socket->flush();
+        std::string remote_transfer;
+        input >> remote_transfer;
+        if (!id)
+          transfer = remote_transfer;
+      }
+      ELLE_DEBUG("%s: negotiate for transfer %s", *this, transfer);
+      auto key = std::make_pair(remote, transfer);
+
       // Check we are not already connected.
       auto check_already = [&] ()
         {
-          if (this->_hosts.find(remote) != this->_hosts.end())
+          if (this->_hosts.find(key) != this->_hosts.end())
           {
             ELLE_TRACE("%s: peer is already connected, reject", *this);
             output << NegotiationStatus::already_connected;
@@ -201,17 +492,17 @@ namespace station
       {
         // If we're already negotiating, wait.
         auto& negotiating = this->_host_negotiating;
-        while (negotiating.find(remote) != negotiating.end())
+        while (negotiating.find(key) != negotiating.end())
         {
           ELLE_DEBUG("%s: already negotiating with this peer, wait", *this);
           reactor::Scheduler::scheduler()->current()->wait(
             this->_negotiation_ended);
           check_already();
         }
-        this->_host_negotiating.insert(remote);
+        this->_host_negotiating.insert(key);
         pop_negotiation.action([&]
                                {
-                                 this->_host_negotiating.erase(remote);
+                                 this->_host_negotiating.erase(key);
                                  this->_negotiation_ended.signal();
                                });
       }
@@ -241,8 +532,8 @@ namespace station
         {
           ELLE_LOG("%s: validate peer %s", *this, remote);
           if (master)
-            ELLE_ASSERT_NCONTAINS(this->_hosts, remote);
-          else if (this->_hosts.find(remote) != this->_hosts.end())
+            ELLE_ASSERT(this->_hosts.find(key) == this->_hosts.end());
+          else if (this->_hosts.find(key) != this->_hosts.end())
           {
             // FIXME: add sequence ids as soon as the station protocol version
             // is fixed (0.9.7).
@@ -250,8 +541,23 @@ namespace station
             throw ConnectionFailure(
               elle::sprintf("%s: conflict on %s", *this, remote));
           }
-          std::unique_ptr<Host> res(new Host(*this, remote, std::move(socket)));
-          this->_hosts[remote] = res.get();
+          // Issue a resumption token for this session.
+          if (remote_protocol >= 2 && !transfer.empty())
+          {
+            std::string token;
+            if (master)
+            {
+              token = session_token_generate();
+              output << token;
+              socket->flush();
+            }
+            else
+              input >> token;
+            this->_session_register(key, token);
+          }
+          std::unique_ptr<Host> res(
+            new Host(*this, remote, transfer, std::move(socket)));
+          this->_hosts[key] = res.get();
           return res;
         }
         case NegotiationStatus::already_connected:
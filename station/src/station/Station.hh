@@ -1,9 +1,11 @@
 #ifndef STATION_STATION_HH
 # define STATION_STATION_HH
 
-# include <queue>
+# include <list>
 # include <unordered_set>
 
+# include <boost/optional.hpp>
+
 # include <elle/attribute.hh>
 
 # include <reactor/Barrier.hh>
@@ -41,11 +43,42 @@ namespace station
   `------*/
   private:
     friend class Host;
-    typedef std::unordered_map<papier::Passport, Host*> Hosts;
+    /// Hosts are unique per peer passport and transfer id.
+    typedef std::pair<papier::Passport, std::string> HostKey;
+    struct HostKeyHash
+    {
+      std::size_t
+      operator ()(HostKey const& key) const;
+    };
+    typedef std::unordered_map<HostKey, Host*, HostKeyHash> Hosts;
+    typedef std::unordered_set<HostKey, HostKeyHash> Negotiating;
     void
     _host_remove(Host const& host);
     ELLE_ATTRIBUTE(Hosts, hosts);
-    ELLE_ATTRIBUTE(std::unordered_set<papier::Passport>, host_negotiating);
+    ELLE_ATTRIBUTE(Negotiating, host_negotiating);
+
+  /*---------.
+  | Sessions |
+  `---------*/
+  private:
+    /// Remember the session negotiated for a host, replacing the previous
+    /// session of its transfer.
+    void
+    _session_register(HostKey const& key, std::string const& token);
+    /// Forget the session of a transfer, if any.
+    void
+    _session_forget(std::string const& id);
+    typedef std::unordered_map<std::string, HostKey> Sessions;
+    typedef std::unordered_map<std::string, std::string> SessionTokens;
+    /// Resumable sessions by token.
+    ELLE_ATTRIBUTE(Sessions, sessions);
+    /// Resumption token by transfer id.
+    ELLE_ATTRIBUTE(SessionTokens, session_tokens);
+    /// Session tokens, oldest first.
+    ELLE_ATTRIBUTE(std::list<std::string>, session_order);
+  public:
+    /// The maximum number of resumable sessions remembered.
+    ELLE_ATTRIBUTE_RW(int, sessions_max);
 
   /*---------------.
   | Authentication |
@@ -64,9 +97,15 @@ namespace station
   public:
     /// Connect to another station.
     ///
-    /// \throw AlreadyConnected if we are already connected to this station.
+    /// If a previous connection for this transfer was negotiated with the
+    /// station, its session is resumed, skipping the passport exchange.
+    ///
+    /// \param id The transfer this connection is for, so a station shared by
+    ///           several transfers can route it.
+    /// \throw AlreadyConnected if we are already connected to this station
+    ///                         for this transfer.
     std::unique_ptr<Host>
-    connect(std::string const& host, int port);
+    connect(std::string const& host, int port, std::string const& id = "");
 
   /*-------.
   | Server |
@@ -74,15 +113,29 @@ namespace station
   public:
     int
     port() const;
+    /// Wait for a host connecting for the given transfer.
+    ///
+    /// Hosts from peers that predate transfer routing are accepted for any
+    /// transfer, but only while it is the only one waiting.
     std::unique_ptr<Host>
-    accept();
+    accept(std::string const& id = "");
+    /// Drop the hosts pending for a transfer that will not accept them, and
+    /// its resumable session.
+    void
+    forget(std::string const& id);
   private:
-    /// Accept connections and negotiate.
+    /// Accept connections and negotiate them concurrently.
     void
     _serve();
-    ///
+    /// Negotiate an incoming connection within the handshake timeout.
+    void
+    _handshake(std::unique_ptr<reactor::network::Socket> socket);
+    /// Negotiate a connection, for transfer id if we are connecting, resuming
+    /// the session of that transfer if asked to.
     std::unique_ptr<Host>
-    _negotiate(std::unique_ptr<reactor::network::Socket> socket);
+    _negotiate(std::unique_ptr<reactor::network::Socket> socket,
+               boost::optional<std::string> const& id = boost::none,
+               bool resume = false);
     /// The TCP servers to receive connection.
     ELLE_ATTRIBUTE_R(reactor::network::TCPServer, server);
     /// The thread running this->_serve().
@@ -90,7 +143,20 @@ namespace station
     /// A barrier open iff a new host is available.
     ELLE_ATTRIBUTE_RX(reactor::Barrier, host_available);
     /// The new hosts.
-    ELLE_ATTRIBUTE  (std::queue<std::unique_ptr<Host>>, host_new);
+    ELLE_ATTRIBUTE  (std::list<std::unique_ptr<Host>>, host_new);
+    typedef std::unordered_map<std::string, int> Accepting;
+    /// The number of accept calls waiting, by transfer id.
+    ELLE_ATTRIBUTE  (Accepting, accepting);
+    /// The maximum duration of an incoming handshake.
+    ELLE_ATTRIBUTE_RW(reactor::Duration, handshake_timeout);
+    /// The maximum number of concurrent incoming handshakes.
+    ELLE_ATTRIBUTE_RW(int, handshake_max);
+    /// The number of incoming handshakes in progress.
+    ELLE_ATTRIBUTE_R(int, handshakes);
+    /// Signals when an incoming handshake ended.
+    ELLE_ATTRIBUTE  (reactor::Signal, handshake_ended);
+    /// Signals when a new host is available.
+    ELLE_ATTRIBUTE  (reactor::Signal, host_arrived);
     /// Signals when a negotiation ended.
     ELLE_ATTRIBUTE  (reactor::Signal, negotiation_ended);
   /*----------.
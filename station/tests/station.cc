@@ -1,10 +1,14 @@
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include <elle/test.hh>
 
 #include <cryptography/KeyPair.hh>
 
 #include <reactor/network/buffer.hh>
+#include <reactor/network/tcp-socket.hh>
 #include <reactor/scheduler.hh>
 #include <reactor/Scope.hh>
+#include <reactor/thread.hh>
 
 #include <station/AlreadyConnected.hh>
 #include <station/Host.hh>
@@ -377,6 +381,261 @@ ELLE_TEST_SCHEDULED(connect_close_connect, (bool, swap))
   };
 }
 
+ELLE_TEST_SCHEDULED(routing)
+{
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background("main", [&]
+    {
+      Credentials c1("host1");
+      station::Station station1(authority, c1.passport);
+      Credentials c2("host2");
+      station::Station station2(authority, c2.passport);
+      // Two transfers between the same peers share the stations.
+      auto host1_a = station1.connect("127.0.0.1", station2.port(), "a");
+      auto host1_b = station1.connect("127.0.0.1", station2.port(), "b");
+      BOOST_CHECK_EQUAL(host1_a->id(), "a");
+      BOOST_CHECK_EQUAL(host1_b->id(), "b");
+      BOOST_CHECK_THROW(station1.connect("127.0.0.1", station2.port(), "a"),
+                        station::AlreadyConnected);
+      // Each transfer is handed its own connection, whatever the order.
+      auto host2_b = station2.accept("b");
+      BOOST_CHECK_EQUAL(host2_b->id(), "b");
+      BOOST_CHECK(station2.host_available());
+      auto host2_a = station2.accept("a");
+      BOOST_CHECK_EQUAL(host2_a->id(), "a");
+      BOOST_CHECK(!station2.host_available());
+    });
+    scope.wait();
+  };
+}
+
+// Hosts without transfer id only go to a lone waiting transfer, and pending
+// hosts of a transfer can be dropped.
+ELLE_TEST_SCHEDULED(routing_anonymous)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  std::unique_ptr<station::Host> host2;
+  reactor::Thread accept_a("accept a",
+                           [&] { host2 = station2.accept("a"); });
+  reactor::Thread accept_b("accept b", [&] { station2.accept("b"); });
+  auto host1 = station1.connect("127.0.0.1", station2.port());
+  reactor::wait(station2.host_available());
+  BOOST_CHECK(!host2);
+  accept_b.terminate_now();
+  reactor::wait(accept_a);
+  BOOST_REQUIRE(host2);
+  BOOST_CHECK(host2->id().empty());
+  BOOST_CHECK(!station2.host_available());
+  auto host1_c = station1.connect("127.0.0.1", station2.port(), "c");
+  reactor::wait(station2.host_available());
+  station2.forget("c");
+  BOOST_CHECK(!station2.host_available());
+}
+
+// Reconnecting for a transfer resumes its session.
+ELLE_TEST_SCHEDULED(resume)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  auto connect = [&] (station::Station& station, int port)
+    {
+      auto start = boost::posix_time::microsec_clock::local_time();
+      auto host1 = station1.connect("127.0.0.1", port, "transfer");
+      auto host2 = station.accept("transfer");
+      BOOST_CHECK_EQUAL(host1->resumed(), host2->resumed());
+      BOOST_CHECK_EQUAL(host1->passport(), station.passport());
+      BOOST_CHECK_EQUAL(host2->passport(), c1.passport);
+      BOOST_CHECK_EQUAL(host2->id(), "transfer");
+      ELLE_LOG("%s connection in %s",
+               host1->resumed() ? "resumed" : "full",
+               boost::posix_time::microsec_clock::local_time() - start);
+      return host1->resumed();
+    };
+  BOOST_CHECK(!connect(station2, station2.port()));
+  // The hosts are gone, as after a network failure.
+  BOOST_CHECK(connect(station2, station2.port()));
+  BOOST_CHECK(connect(station2, station2.port()));
+  // A station that doesn't know the session negotiates from scratch.
+  Credentials c3("host3");
+  station::Station station3(authority, c3.passport);
+  BOOST_CHECK(!connect(station3, station3.port()));
+  BOOST_CHECK(connect(station3, station3.port()));
+}
+
+// Both ends resuming a session towards each other at once settle on a single
+// connection.
+ELLE_TEST_SCHEDULED(resume_concurrent)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  {
+    auto host1 = station1.connect("127.0.0.1", station2.port(), "transfer");
+    auto host2 = station2.accept("transfer");
+  }
+  std::unique_ptr<station::Host> host1;
+  std::unique_ptr<station::Host> host2;
+  int already = 0;
+  auto connect = [&] (station::Station& station,
+                      int port,
+                      std::unique_ptr<station::Host>& host)
+    {
+      try
+      {
+        host = station.connect("127.0.0.1", port, "transfer");
+      }
+      catch (station::AlreadyConnected const&)
+      {
+        ++already;
+      }
+    };
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    scope.run_background("1 -> 2", [&]
+    {
+      connect(station1, station2.port(), host1);
+    });
+    scope.run_background("2 -> 1", [&]
+    {
+      connect(station2, station1.port(), host2);
+    });
+    scope.wait();
+  };
+  BOOST_CHECK_EQUAL(already, 1);
+  if (host1)
+    host2 = station2.accept("transfer");
+  else
+    host1 = station1.accept("transfer");
+  BOOST_CHECK(host1->resumed());
+  BOOST_CHECK(host2->resumed());
+  BOOST_CHECK(!station1.host_available());
+  BOOST_CHECK(!station2.host_available());
+  char buf[4];
+  buf[3] = 0;
+  host1->socket().write(elle::ConstWeakBuffer("one"));
+  host2->socket().read(reactor::network::Buffer(buf, 3));
+  BOOST_CHECK_EQUAL(buf, "one");
+}
+
+// Stations remember a bounded number of sessions, and forget those of ended
+// transfers.
+ELLE_TEST_SCHEDULED(resume_forget)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  station1.sessions_max(1);
+  auto connect = [&] (std::string const& id)
+    {
+      auto host1 = station1.connect("127.0.0.1", station2.port(), id);
+      auto host2 = station2.accept(id);
+      return host1->resumed();
+    };
+  BOOST_CHECK(!connect("a"));
+  BOOST_CHECK(connect("a"));
+  BOOST_CHECK(!connect("b"));
+  BOOST_CHECK(!connect("a"));
+  BOOST_CHECK(connect("a"));
+  station1.forget("a");
+  BOOST_CHECK(!connect("a"));
+}
+
+// A peer stalling in the handshake must not prevent others from connecting.
+ELLE_TEST_SCHEDULED(handshake_concurrent)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  reactor::network::TCPSocket silent("127.0.0.1", station2.port());
+  // Read the version byte and never answer.
+  silent.read(1);
+  auto host1 = station1.connect("127.0.0.1", station2.port());
+  auto host2 = station2.accept();
+  BOOST_CHECK_EQUAL(host2->passport(), c1.passport);
+}
+
+ELLE_TEST_SCHEDULED(handshake_timeout)
+{
+  Credentials c("host");
+  station::Station station(authority, c.passport);
+  station.handshake_timeout(500_ms);
+  reactor::network::TCPSocket silent("127.0.0.1", station.port());
+  silent.read(1);
+  // The station gives up on us and closes the connection.
+  BOOST_CHECK_THROW(silent.read(1), std::runtime_error);
+  BOOST_CHECK_EQUAL(station.handshakes(), 0);
+}
+
+ELLE_TEST_SCHEDULED(handshake_max)
+{
+  Credentials c1("host1");
+  station::Station station1(authority, c1.passport);
+  Credentials c2("host2");
+  station::Station station2(authority, c2.passport);
+  station2.handshake_timeout(500_ms);
+  station2.handshake_max(1);
+  reactor::network::TCPSocket silent("127.0.0.1", station2.port());
+  silent.read(1);
+  // The only handshake slot is taken until the silent peer times out.
+  auto start = boost::posix_time::microsec_clock::local_time();
+  auto host1 = station1.connect("127.0.0.1", station2.port());
+  auto host2 = station2.accept();
+  BOOST_CHECK_GE(boost::posix_time::microsec_clock::local_time() - start,
+                 boost::posix_time::milliseconds(400));
+}
+
+// Accept rate under many simultaneous connecting peers.
+ELLE_TEST_SCHEDULED(accept_rate)
+{
+  unsigned const count = 16;
+  Credentials c("server");
+  station::Station server(authority, c.passport);
+  std::vector<std::unique_ptr<Credentials>> credentials;
+  std::vector<std::unique_ptr<station::Station>> peers;
+  for (unsigned i = 0; i < count; ++i)
+  {
+    credentials.emplace_back(new Credentials(elle::sprintf("peer%s", i)));
+    peers.emplace_back(
+      new station::Station(authority, credentials.back()->passport));
+  }
+  std::vector<std::unique_ptr<station::Host>> connected;
+  std::vector<std::unique_ptr<station::Host>> accepted;
+  auto start = boost::posix_time::microsec_clock::local_time();
+  elle::With<reactor::Scope>() << [&] (reactor::Scope& scope)
+  {
+    for (auto& peer: peers)
+      scope.run_background(
+        elle::sprintf("connect %s", *peer),
+        [&]
+        {
+          connected.emplace_back(peer->connect("127.0.0.1", server.port()));
+        });
+    scope.run_background(
+      "accept",
+      [&]
+      {
+        for (unsigned i = 0; i < count; ++i)
+          accepted.emplace_back(server.accept());
+      });
+    scope.wait();
+  };
+  auto elapsed = boost::posix_time::microsec_clock::local_time() - start;
+  ELLE_LOG("accepted %s peers in %s (%s/s)",
+           count, elapsed,
+           count * 1000000. / std::max<long>(elapsed.total_microseconds(), 1));
+  BOOST_CHECK_EQUAL(connected.size(), count);
+  BOOST_CHECK_EQUAL(accepted.size(), count);
+}
+
 ELLE_TEST_SUITE()
 {
   auto timeout = valgrind(20);
@@ -388,10 +647,19 @@ ELLE_TEST_SUITE()
 #endif
   suite.add(BOOST_TEST_CASE(connection_closed), 0, timeout);
   suite.add(BOOST_TEST_CASE(already_connected), 0, timeout);
+  suite.add(BOOST_TEST_CASE(routing), 0, timeout);
+  suite.add(BOOST_TEST_CASE(routing_anonymous), 0, timeout);
   suite.add(BOOST_TEST_CASE(reconnect), 0, timeout);
   suite.add(BOOST_TEST_CASE(destruct_pending), 0, timeout);
   suite.add(BOOST_TEST_CASE(double_connection), 0, timeout);
   suite.add(BOOST_TEST_CASE(connection_close), 0, timeout);
+  suite.add(BOOST_TEST_CASE(resume), 0, timeout);
+  suite.add(BOOST_TEST_CASE(resume_concurrent), 0, timeout);
+  suite.add(BOOST_TEST_CASE(resume_forget), 0, timeout);
+  suite.add(BOOST_TEST_CASE(handshake_concurrent), 0, timeout);
+  suite.add(BOOST_TEST_CASE(handshake_timeout), 0, timeout);
+  suite.add(BOOST_TEST_CASE(handshake_max), 0, timeout);
+  suite.add(BOOST_TEST_CASE(accept_rate), 0, valgrind(60));
   auto connect_close_connect_first = std::bind(&connect_close_connect, true);
   suite.add(BOOST_TEST_CASE(connect_close_connect_first), 0, timeout);
   auto connect_close_connect_second = std::bind(&connect_close_connect, false);